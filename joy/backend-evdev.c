@@ -0,0 +1,238 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The event interface: /dev/input/event*. Unlike joydev, it reports
+ * native axis values, microsecond timestamps, and the boundaries between
+ * hardware reports. */
+#include <string.h>
+#include <time.h>
+
+#include <sys/ioctl.h>
+
+#include <linux/input.h>
+
+#include "joy-private.h"
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define NLONGS(x) (((x) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+/* Marks codes that are not mapped to an axis or button */
+#define UNMAPPED 0xff
+
+typedef struct _EvdevData EvdevData;
+
+struct _EvdevData {
+	gboolean dropped;
+	gint64 offset;
+	guint8 naxes;
+	guint8 nbuts;
+	guint8 absidx[ABS_CNT];
+	guint8 keyidx[KEY_CNT - BTN_MISC];
+	guint8 axmap[JOY_STICK_MAX_AXES];
+	guint16 butmap[JOY_STICK_MAX_BUTTONS];
+};
+
+static void evdev_add_button(EvdevData* d, guint code) {
+	/* n_buttons is a guint8 */
+	if(d->nbuts == G_MAXUINT8) {
+		return;
+	}
+	d->keyidx[code - BTN_MISC] = d->nbuts;
+	d->butmap[d->nbuts++] = code;
+}
+
+static gboolean evdev_probe(int fd, JoyDeviceInfo* info, gpointer* data) {
+	unsigned long absbits[NLONGS(ABS_CNT)] = { 0, };
+	unsigned long keybits[NLONGS(KEY_CNT)] = { 0, };
+	unsigned long keys[NLONGS(KEY_CNT)] = { 0, };
+	int clk = CLOCK_MONOTONIC;
+	int version;
+	EvdevData* d;
+
+	if(ioctl(fd, EVIOCGVERSION, &version) < 0) {
+		return FALSE;
+	}
+	ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits);
+	ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits);
+	d = g_new0(EvdevData, 1);
+	/* Have the kernel timestamp events with the same clock as
+	 * g_get_monotonic_time(). Kernels before 3.4 can only use
+	 * CLOCK_REALTIME; translate that as well as we can. */
+	if(ioctl(fd, EVIOCSCLOCKID, &clk) < 0) {
+		d->offset = g_get_monotonic_time() - g_get_real_time();
+	}
+	memset(d->absidx, UNMAPPED, sizeof(d->absidx));
+	memset(d->keyidx, UNMAPPED, sizeof(d->keyidx));
+	/* Multitouch axes are not joystick axes */
+	for(guint code=0; code<ABS_MT_SLOT && d->naxes<JOY_STICK_MAX_AXES; code++) {
+		struct input_absinfo abs;
+
+		if(!TEST_BIT(code, absbits) || ioctl(fd, EVIOCGABS(code), &abs) < 0) {
+			continue;
+		}
+		info->axmin[d->naxes] = abs.minimum;
+		info->axmax[d->naxes] = abs.maximum;
+		info->axval[d->naxes] = abs.value;
+		d->absidx[code] = d->naxes;
+		d->axmap[d->naxes++] = code;
+	}
+	/* Same button order as joydev */
+	for(guint code=BTN_JOYSTICK; code<KEY_CNT; code++) {
+		if(TEST_BIT(code, keybits)) {
+			evdev_add_button(d, code);
+		}
+	}
+	for(guint code=BTN_MISC; code<BTN_JOYSTICK; code++) {
+		if(TEST_BIT(code, keybits)) {
+			evdev_add_button(d, code);
+		}
+	}
+	/* Unlike joydev, evdev sends no state dump when it is opened; a
+	 * resting device may not send anything for a long time */
+	ioctl(fd, EVIOCGKEY(sizeof(keys)), keys);
+	for(guint i=0; i<d->nbuts; i++) {
+		if(TEST_BIT(d->butmap[i], keys)) {
+			info->buttons[i / 64] |= G_GUINT64_CONSTANT(1) << (i % 64);
+		}
+	}
+	info->naxes = d->naxes;
+	info->nbuts = d->nbuts;
+	memcpy(info->axmap, d->axmap, d->naxes * sizeof(guint8));
+	memcpy(info->butmap, d->butmap, d->nbuts * sizeof(guint16));
+	ioctl(fd, EVIOCGNAME(JOY_NAME_LEN), info->name);
+	*data = d;
+	return TRUE;
+}
+
+/* After the kernel dropped events, fetch the complete state of the device
+ * instead. The core only issues the values that differ from what it knew. */
+static gsize evdev_dump(EvdevData* d, int fd, gint64 time, JoyEvent* events) {
+	unsigned long keys[NLONGS(KEY_CNT)] = { 0, };
+	gsize n = 0;
+
+	for(guint i=0; i<d->naxes; i++) {
+		struct input_absinfo abs;
+
+		if(ioctl(fd, EVIOCGABS(d->axmap[i]), &abs) < 0) {
+			continue;
+		}
+		events[n].time = time;
+		events[n].value = abs.value;
+		events[n].type = JOY_EVENT_AXIS;
+		events[n].number = i;
+		events[n].flags = JOY_EVENT_INIT;
+		n++;
+	}
+	ioctl(fd, EVIOCGKEY(sizeof(keys)), keys);
+	for(guint i=0; i<d->nbuts; i++) {
+		events[n].time = time;
+		events[n].value = TEST_BIT(d->butmap[i], keys);
+		events[n].type = JOY_EVENT_BUTTON;
+		events[n].number = i;
+		events[n].flags = JOY_EVENT_INIT;
+		n++;
+	}
+	events[n].time = time;
+	events[n].value = 0;
+	events[n].type = JOY_EVENT_SYNC;
+	events[n].number = 0;
+	events[n].flags = JOY_EVENT_INIT;
+	return n + 1;
+}
+
+static gsize evdev_convert(gpointer data, int fd, const void* records, gsize count, JoyEvent* events) {
+	EvdevData* d = data;
+	const struct input_event* ies = records;
+	gboolean dumped = FALSE;
+	gsize n = 0;
+
+	for(gsize i=0; i<count; i++) {
+		const struct input_event* ie = &ies[i];
+		JoyEvent* ev = &events[n];
+
+		ev->time = (gint64)ie->input_event_sec * G_USEC_PER_SEC + ie->input_event_usec + d->offset;
+		ev->value = ie->value;
+		ev->flags = 0;
+		if(d->dropped) {
+			/* Everything up to the next report is incomplete.
+			 * We only have room for one state dump per call; if
+			 * we need another, wait for the next report. */
+			if(ie->type == EV_SYN && ie->code == SYN_REPORT && !dumped) {
+				n += evdev_dump(d, fd, ev->time, ev);
+				d->dropped = FALSE;
+				dumped = TRUE;
+			}
+			continue;
+		}
+		switch(ie->type) {
+			case EV_ABS:
+				if(ie->code >= ABS_CNT || d->absidx[ie->code] == UNMAPPED) {
+					continue;
+				}
+				ev->type = JOY_EVENT_AXIS;
+				ev->number = d->absidx[ie->code];
+				break;
+			case EV_KEY:
+				/* value 2 is autorepeat */
+				if(ie->code < BTN_MISC || ie->code >= KEY_CNT || d->keyidx[ie->code - BTN_MISC] == UNMAPPED || ie->value > 1) {
+					continue;
+				}
+				ev->type = JOY_EVENT_BUTTON;
+				ev->number = d->keyidx[ie->code - BTN_MISC];
+				break;
+			case EV_SYN:
+				if(ie->code == SYN_DROPPED) {
+					d->dropped = TRUE;
+					continue;
+				}
+				if(ie->code != SYN_REPORT) {
+					continue;
+				}
+				ev->type = JOY_EVENT_SYNC;
+				ev->number = 0;
+				break;
+			default:
+				continue;
+		}
+		n++;
+	}
+	return n;
+}
+
+static gboolean evdev_grab(gpointer data G_GNUC_UNUSED, int fd, gboolean grab) {
+	return ioctl(fd, EVIOCGRAB, grab ? 1 : 0) == 0;
+}
+
+const JoyBackend _joy_backend_evdev = {
+	"evdev",
+	sizeof(struct input_event),
+	NULL,	/* prefix */
+	NULL,	/* open */
+	evdev_probe,
+	evdev_convert,
+	evdev_grab,
+	g_free,
+};
@@ -0,0 +1,136 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The legacy joystick interface: /dev/input/js* */
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/ioctl.h>
+
+#include <linux/input.h>
+#include <linux/joystick.h>
+
+#include "joy-private.h"
+
+typedef struct _JoydevData JoydevData;
+
+/* js_event.time is a 32-bit millisecond counter derived from jiffies: it
+ * wraps after about 49 days, and has an arbitrary offset relative to
+ * CLOCK_MONOTONIC. high holds the wraps we have seen, offset maps the
+ * result onto g_get_monotonic_time(). */
+struct _JoydevData {
+	guint32 last;
+	gint64 high;
+	gint64 offset;
+	gboolean calibrated;
+};
+
+static gboolean joydev_probe(int fd, JoyDeviceInfo* info, gpointer* data) {
+	uint8_t axmap[ABS_MAX + 1] = { 0, };
+	uint16_t butmap[KEY_MAX - BTN_MISC + 1] = { 0, };
+
+	/* Anything that is not a joystick (e.g., a FIFO) has no axes and no
+	 * buttons; accept it anyway, since this is the fallback backend */
+	ioctl(fd, JSIOCGAXES, &(info->naxes));
+	ioctl(fd, JSIOCGBUTTONS, &(info->nbuts));
+	info->naxes = MIN(info->naxes, JOY_STICK_MAX_AXES);
+	ioctl(fd, JSIOCGAXMAP, axmap);
+	ioctl(fd, JSIOCGBTNMAP, butmap);
+	memcpy(info->axmap, axmap, info->naxes * sizeof(uint8_t));
+	memcpy(info->butmap, butmap, info->nbuts * sizeof(uint16_t));
+	for(guint i=0; i<info->naxes; i++) {
+		/* joydev scales every axis to this range */
+		info->axmin[i] = -32767;
+		info->axmax[i] = 32767;
+	}
+	ioctl(fd, JSIOCGNAME(JOY_NAME_LEN), info->name);
+	*data = g_new0(JoydevData, 1);
+	return TRUE;
+}
+
+static gint64 joydev_time(JoydevData* d, guint32 time, gint64 now) {
+	gint64 usec;
+
+	if(time < d->last && d->last - time > G_MAXINT32) {
+		d->high += G_GINT64_CONSTANT(1) << 32;
+	}
+	d->last = time;
+	usec = (d->high + time) * 1000;
+	/* An event cannot have happened after we read it. The first event
+	 * gives a first estimate of the offset; events that would end up
+	 * in the future move it back, so that it converges on the smallest
+	 * delay between an event and us reading it. */
+	if(!d->calibrated || usec + d->offset > now) {
+		d->offset = now - usec;
+		d->calibrated = TRUE;
+	}
+	return usec + d->offset;
+}
+
+/* joydev does not mark the end of a report of the hardware; but all
+ * events of one report carry the same timestamp. A report also ends with
+ * the last record we were given, since we do not know when the next
+ * record will arrive. */
+static gsize joydev_convert(gpointer data, int fd G_GNUC_UNUSED, const void* records, gsize count, JoyEvent* events) {
+	const struct js_event* evs = records;
+	gint64 now = g_get_monotonic_time();
+	gsize n = 0;
+
+	for(gsize i=0; i<count; i++) {
+		JoyEvent* ev = &events[n++];
+
+		ev->time = joydev_time(data, evs[i].time, now);
+		ev->value = evs[i].value;
+		ev->number = evs[i].number;
+		ev->flags = (evs[i].type & JS_EVENT_INIT) ? JOY_EVENT_INIT : 0;
+		switch(evs[i].type & ~JS_EVENT_INIT) {
+			case JS_EVENT_BUTTON:
+				ev->type = JOY_EVENT_BUTTON;
+				break;
+			case JS_EVENT_AXIS:
+				ev->type = JOY_EVENT_AXIS;
+				break;
+			default:
+				ev->type = JOY_EVENT_NONE;
+				break;
+		}
+		if(i + 1 == count || evs[i + 1].time != evs[i].time) {
+			JoyEvent* sync = &events[n++];
+
+			sync->time = ev->time;
+			sync->value = 0;
+			sync->number = 0;
+			sync->flags = ev->flags;
+			sync->type = JOY_EVENT_SYNC;
+		}
+	}
+	return n;
+}
+
+const JoyBackend _joy_backend_joydev = {
+	"joydev",
+	sizeof(struct js_event),
+	NULL,	/* prefix */
+	NULL,	/* open */
+	joydev_probe,
+	joydev_convert,
+	NULL,	/* grab */
+	g_free,
+};
@@ -0,0 +1,268 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This program is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+/* Measure the cost of handling an event in JoyStick.
+ *
+ * Every "device" is a FIFO, opened through joy_stick_open() and given a
+ * layout of axes and buttons, so that events are issued as signals just
+ * like those of a real joystick. The benchmark writes a synthetic stream
+ * of js_event structures into the FIFOs, and measures only the time it
+ * takes libjoy to handle them:
+ *
+ *	iteration	one device in %JOY_MODE_MANUAL mode, one
+ *			joy_stick_iteration() call per event
+ *	mainloop	%JOY_MODE_MAINLOOP mode, with 1 up to --devices
+ *			devices attached to the same main context
+ *
+ * Each benchmark runs without any signal handlers (which exercises the
+ * path that skips emission) and with handlers for every signal.
+ *
+ * The allocations made while handling events are counted as well, for
+ * information; that the dispatch path does not allocate at all is checked
+ * by test-dispatch, in make check.
+ *
+ * Output is one line per run, as space-separated key=value pairs. */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/joystick.h>
+#include <sys/resource.h>
+
+#include <joy/joystick.h>
+#include "bench-util.h"
+
+#define NAXES 8
+#define NBUTTONS 16
+/* Fits in the buffer of a FIFO */
+#define CHUNK 4096
+
+static gint nevents = 200000;
+static gint maxdevs = 1000;
+static gint burst = 16;
+
+static GOptionEntry entries[] = {
+	{ "events", 'e', 0, G_OPTION_ARG_INT, &nevents, "Number of events per run", "N" },
+	{ "devices", 'd', 0, G_OPTION_ARG_INT, &maxdevs, "Largest number of simulated devices", "N" },
+	{ "burst", 'b', 0, G_OPTION_ARG_INT, &burst, "Number of events written to a device at once", "N" },
+	{ NULL },
+};
+
+typedef struct _Run Run;
+
+struct _Run {
+	const gchar* name;
+	gboolean handlers;
+	gint ndevs;
+	int error;
+	JoyStick** sticks;
+	int* wfds;
+	guint64 events;
+	guint64 signals;
+	guint64 allocs;
+	gint64 usec;
+};
+
+static void on_button(JoyStick* stick G_GNUC_UNUSED, guchar button G_GNUC_UNUSED, gpointer data) {
+	((Run*)data)->signals++;
+}
+
+static void on_axis(JoyStick* stick G_GNUC_UNUSED, guchar axis G_GNUC_UNUSED, gint value G_GNUC_UNUSED, gpointer data) {
+	((Run*)data)->signals++;
+}
+
+static gboolean setup(Run* run, const gchar* dir, JoyMode mode) {
+	run->sticks = g_new0(JoyStick*, run->ndevs);
+	run->wfds = g_new(int, run->ndevs);
+	for(gint i=0; i<run->ndevs; i++) {
+		gchar* path = g_strdup_printf("%s/js%d", dir, i);
+
+		run->sticks[i] = fifo_stick_open(path, NAXES, NBUTTONS, &run->wfds[i]);
+		g_free(path);
+		if(!run->sticks[i]) {
+			run->error = errno;
+			run->ndevs = i;
+			return FALSE;
+		}
+		joy_stick_set_mode(run->sticks[i], mode);
+		if(run->handlers) {
+			g_signal_connect(run->sticks[i], "button-pressed", G_CALLBACK(on_button), run);
+			g_signal_connect(run->sticks[i], "button-released", G_CALLBACK(on_button), run);
+			g_signal_connect(run->sticks[i], "axis-moved", G_CALLBACK(on_axis), run);
+		}
+	}
+	return TRUE;
+}
+
+static void teardown(Run* run, const gchar* dir) {
+	for(gint i=0; i<run->ndevs; i++) {
+		gchar* path = g_strdup_printf("%s/js%d", dir, i);
+
+		g_object_unref(run->sticks[i]);
+		close(run->wfds[i]);
+		unlink(path);
+		g_free(path);
+	}
+	g_free(run->sticks);
+	g_free(run->wfds);
+}
+
+static void skipped(Run* run, gint ndevs) {
+	printf("bench=%s handlers=%s devices=%d skipped=yes errno=%d\n", run->name, run->handlers ? "yes" : "no", ndevs, run->error);
+	fflush(stdout);
+}
+
+static void report(Run* run) {
+	printf("bench=%s handlers=%s devices=%d events=%" G_GUINT64_FORMAT " signals=%" G_GUINT64_FORMAT " seconds=%.6f events_per_sec=%.0f ns_per_event=%.1f allocs_per_event=%.4f\n",
+		run->name,
+		run->handlers ? "yes" : "no",
+		run->ndevs,
+		run->events,
+		run->signals,
+		run->usec / 1e6,
+		run->events / (run->usec / 1e6),
+		run->usec * 1000.0 / run->events,
+		(double)run->allocs / run->events);
+	fflush(stdout);
+}
+
+static void measure_start(gint64* start) {
+	alloc_count_start();
+	*start = g_get_monotonic_time();
+}
+
+static void measure_stop(Run* run, gint64 start) {
+	run->usec += g_get_monotonic_time() - start;
+	run->allocs += alloc_count_stop();
+}
+
+static void bench_iteration(const gchar* dir, gboolean handlers) {
+	Run run = { "iteration", handlers, 1, };
+	struct js_event* evs = g_new(struct js_event, CHUNK);
+
+	if(!setup(&run, dir, JOY_MODE_MANUAL)) {
+		skipped(&run, 1);
+		teardown(&run, dir);
+		g_free(evs);
+		return;
+	}
+	while(run.events < (guint64)nevents) {
+		gint n = MIN(CHUNK, nevents - (gint)run.events);
+		gint64 start;
+
+		js_event_fill(evs, n, run.events, NAXES, NBUTTONS);
+		if(write(run.wfds[0], evs, n * sizeof(struct js_event)) < 0) {
+			g_error("Could not write events: %s", g_strerror(errno));
+		}
+		measure_start(&start);
+		for(gint i=0; i<n; i++) {
+			joy_stick_iteration(run.sticks[0]);
+		}
+		measure_stop(&run, start);
+		run.events += n;
+	}
+	report(&run);
+	teardown(&run, dir);
+	g_free(evs);
+}
+
+static void bench_mainloop(const gchar* dir, gint ndevs, gboolean handlers) {
+	Run run = { "mainloop", handlers, ndevs, };
+	struct js_event* evs = g_new(struct js_event, burst);
+	/* The same number of events in total, however many devices */
+	gint perdev = MAX(nevents / ndevs, burst);
+
+	if(!setup(&run, dir, JOY_MODE_MAINLOOP)) {
+		skipped(&run, ndevs);
+		teardown(&run, dir);
+		g_free(evs);
+		return;
+	}
+	/* Get the sources set up */
+	while(g_main_context_iteration(NULL, FALSE));
+	for(gint sent=0; sent<perdev; sent+=burst) {
+		gint64 start;
+
+		js_event_fill(evs, burst, sent, NAXES, NBUTTONS);
+		for(gint i=0; i<ndevs; i++) {
+			if(write(run.wfds[i], evs, burst * sizeof(struct js_event)) < 0) {
+				g_error("Could not write events: %s", g_strerror(errno));
+			}
+		}
+		/* Writing to a FIFO completes immediately, so all devices are
+		 * readable now */
+		measure_start(&start);
+		while(g_main_context_iteration(NULL, FALSE));
+		measure_stop(&run, start);
+		run.events += (guint64)burst * ndevs;
+	}
+	report(&run);
+	teardown(&run, dir);
+	g_free(evs);
+}
+
+static void raise_file_limit(void) {
+	struct rlimit rl;
+
+	/* Every device takes two file descriptors */
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+int main(int argc, char** argv) {
+	GOptionContext* ctx;
+	GError* err = NULL;
+	gchar* dir;
+
+	ctx = g_option_context_new("- measure the cost of handling joystick events");
+	g_option_context_add_main_entries(ctx, entries, NULL);
+	if(!g_option_context_parse(ctx, &argc, &argv, &err)) {
+		fprintf(stderr, "%s\n", err->message);
+		exit(EXIT_FAILURE);
+	}
+	g_option_context_free(ctx);
+	if(nevents < 1 || maxdevs < 1 || burst < 1 || burst > CHUNK) {
+		fprintf(stderr, "invalid arguments\n");
+		exit(EXIT_FAILURE);
+	}
+	raise_file_limit();
+	dir = g_dir_make_tmp("joybench-XXXXXX", &err);
+	if(!dir) {
+		fprintf(stderr, "%s\n", err->message);
+		exit(EXIT_FAILURE);
+	}
+	for(gint handlers=0; handlers<2; handlers++) {
+		bench_iteration(dir, handlers);
+	}
+	for(gint handlers=0; handlers<2; handlers++) {
+		for(gint ndevs=1; ndevs<=maxdevs; ndevs*=10) {
+			bench_mainloop(dir, ndevs, handlers);
+		}
+	}
+	rmdir(dir);
+	g_free(dir);
+
+	return 0;
+}
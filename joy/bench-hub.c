@@ -0,0 +1,176 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This program is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+/* Compare the epoll and io_uring backends of JoyHub.
+ *
+ * Every "device" is a FIFO, opened through joy_stick_open(). The
+ * benchmark writes bursts of js_event structures into all FIFOs, and runs
+ * the main loop until the hub has read all of them. Since a FIFO does not
+ * answer the joystick ioctl()s, the events are read and validated but not
+ * issued as signals; what is measured is the cost of getting the events
+ * out of the kernel.
+ *
+ * Output is one line per backend, as space-separated key=value pairs. */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/joystick.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <joy/joyhub.h>
+
+static gint ndevs = 64;
+static gint nevents = 20000;
+static gint burst = 16;
+
+static GOptionEntry entries[] = {
+	{ "devices", 'd', 0, G_OPTION_ARG_INT, &ndevs, "Number of simulated devices", "N" },
+	{ "events", 'e', 0, G_OPTION_ARG_INT, &nevents, "Number of events per device", "N" },
+	{ "burst", 'b', 0, G_OPTION_ARG_INT, &burst, "Number of events written to a device at once", "N" },
+	{ NULL },
+};
+
+static gboolean pending(int* wfds) {
+	for(int i=0; i<ndevs; i++) {
+		int n = 0;
+		if(ioctl(wfds[i], FIONREAD, &n) == 0 && n > 0) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void run(const gchar* dir, JoyHubBackend backend) {
+	JoyHub* hub = joy_hub_new_with_backend(backend);
+	GSource* source;
+	JoyStick** sticks = g_new0(JoyStick*, ndevs);
+	int* wfds = g_new(int, ndevs);
+	struct js_event* evs = g_new0(struct js_event, burst);
+	struct rusage before, after;
+	gint64 start, end;
+	guint64 total;
+
+	if(joy_hub_get_backend(hub) != backend) {
+		printf("backend=%s unavailable\n", backend == JOY_HUB_BACKEND_IO_URING ? "io_uring" : "epoll");
+		g_object_unref(hub);
+		g_free(sticks);
+		g_free(wfds);
+		g_free(evs);
+		return;
+	}
+	for(int i=0; i<ndevs; i++) {
+		gchar* path = g_strdup_printf("%s/js%d", dir, i);
+		mkfifo(path, 0600);
+		/* Opening read-write first makes sure the read-only open()
+		 * in libjoy does not block */
+		wfds[i] = open(path, O_RDWR | O_NONBLOCK);
+		sticks[i] = joy_stick_open(path);
+		if(wfds[i] < 0 || !sticks[i]) {
+			g_error("Could not set up %s: %s", path, g_strerror(errno));
+		}
+		joy_hub_add(hub, sticks[i]);
+		g_free(path);
+	}
+	source = joy_hub_create_source(hub);
+	g_source_attach(source, NULL);
+
+	for(int i=0; i<burst; i++) {
+		evs[i].type = JS_EVENT_AXIS;
+		evs[i].number = 0;
+	}
+	getrusage(RUSAGE_SELF, &before);
+	start = g_get_monotonic_time();
+	for(int sent=0; sent<nevents; sent+=burst) {
+		for(int i=0; i<ndevs; i++) {
+			for(int j=0; j<burst; j++) {
+				evs[j].time = sent + j;
+				evs[j].value = sent + j;
+			}
+			if(write(wfds[i], evs, burst * sizeof(struct js_event)) < 0) {
+				g_error("Could not write events: %s", g_strerror(errno));
+			}
+		}
+		while(pending(wfds)) {
+			g_main_context_iteration(NULL, TRUE);
+		}
+		while(g_main_context_iteration(NULL, FALSE));
+	}
+	end = g_get_monotonic_time();
+	getrusage(RUSAGE_SELF, &after);
+
+	total = (guint64)ndevs * (((nevents + burst - 1) / burst) * burst);
+	printf("backend=%s devices=%d events=%" G_GUINT64_FORMAT " burst=%d seconds=%.6f events_per_sec=%.0f ns_per_event=%.1f context_switches=%ld\n",
+		backend == JOY_HUB_BACKEND_IO_URING ? "io_uring" : "epoll",
+		ndevs, total, burst,
+		(end - start) / 1e6,
+		total / ((end - start) / 1e6),
+		(end - start) * 1000.0 / total,
+		(after.ru_nvcsw + after.ru_nivcsw) - (before.ru_nvcsw + before.ru_nivcsw));
+
+	g_source_destroy(source);
+	g_source_unref(source);
+	g_object_unref(hub);
+	for(int i=0; i<ndevs; i++) {
+		gchar* path = g_strdup_printf("%s/js%d", dir, i);
+		g_object_unref(sticks[i]);
+		close(wfds[i]);
+		unlink(path);
+		g_free(path);
+	}
+	g_free(sticks);
+	g_free(wfds);
+	g_free(evs);
+}
+
+int main(int argc, char** argv) {
+	GOptionContext* ctx;
+	GError* err = NULL;
+	gchar* dir;
+
+	ctx = g_option_context_new("- compare JoyHub backends");
+	g_option_context_add_main_entries(ctx, entries, NULL);
+	if(!g_option_context_parse(ctx, &argc, &argv, &err)) {
+		fprintf(stderr, "%s\n", err->message);
+		exit(EXIT_FAILURE);
+	}
+	g_option_context_free(ctx);
+	if(ndevs < 1 || nevents < 1 || burst < 1 || burst * sizeof(struct js_event) > 4096) {
+		fprintf(stderr, "invalid arguments\n");
+		exit(EXIT_FAILURE);
+	}
+	dir = g_dir_make_tmp("joybench-XXXXXX", &err);
+	if(!dir) {
+		fprintf(stderr, "%s\n", err->message);
+		exit(EXIT_FAILURE);
+	}
+	run(dir, JOY_HUB_BACKEND_EPOLL);
+	run(dir, JOY_HUB_BACKEND_IO_URING);
+	rmdir(dir);
+	g_free(dir);
+
+	return 0;
+}
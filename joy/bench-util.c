@@ -0,0 +1,108 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This program is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <linux/joystick.h>
+
+#include "bench-util.h"
+#include "joy-private.h"
+
+/* glib's own allocations all end up in these */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static gint counting;
+static guint64 nallocs;
+
+static void count_alloc(void) {
+	if(__atomic_load_n(&counting, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&nallocs, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void* malloc(size_t size) {
+	count_alloc();
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+	count_alloc();
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	count_alloc();
+	return __libc_realloc(ptr, size);
+}
+
+void alloc_count_start(void) {
+	__atomic_store_n(&nallocs, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&counting, 1, __ATOMIC_RELAXED);
+}
+
+guint64 alloc_count_stop(void) {
+	__atomic_store_n(&counting, 0, __ATOMIC_RELAXED);
+	return __atomic_load_n(&nallocs, __ATOMIC_RELAXED);
+}
+
+JoyStick* fifo_stick_open(const gchar* path, guint8 naxes, guint8 nbuttons, int* wfd) {
+	JoyStick* stick;
+	int err;
+
+	mkfifo(path, 0600);
+	/* Opening read-write first makes sure the read-only open() in
+	 * libjoy does not block */
+	*wfd = open(path, O_RDWR | O_NONBLOCK);
+	if(*wfd < 0) {
+		return NULL;
+	}
+	stick = joy_stick_open(path);
+	if(_joy_stick_get_fd(stick) < 0) {
+		err = errno;
+		g_object_unref(stick);
+		close(*wfd);
+		errno = err;
+		return NULL;
+	}
+	_joy_stick_set_layout(stick, naxes, nbuttons);
+	return stick;
+}
+
+void js_event_fill(struct js_event* evs, gint count, guint64 seq, guint8 naxes, guint8 nbuttons) {
+	for(gint i=0; i<count; i++, seq++) {
+		evs[i].time = seq;
+		if(seq % 4 == 3) {
+			evs[i].type = JS_EVENT_BUTTON;
+			evs[i].number = (seq / 4) % nbuttons;
+			evs[i].value = (seq / (4 * nbuttons)) & 1;
+		} else {
+			evs[i].type = JS_EVENT_AXIS;
+			evs[i].number = seq % naxes;
+			evs[i].value = (gint16)(seq * 7919);
+		}
+	}
+}
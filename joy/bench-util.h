@@ -0,0 +1,52 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This program is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+#ifndef LIBJOY_BENCH_UTIL_H
+#define LIBJOY_BENCH_UTIL_H
+
+/* Helpers shared by the benchmarks and the tests; not part of libjoy */
+
+#include <joy/joystick.h>
+
+struct js_event;
+
+G_BEGIN_DECLS
+
+/* Count the calls to malloc(), calloc() and realloc() (which is where
+ * all of glib's allocations end up) from any thread, between these two
+ * calls; alloc_count_stop() returns the number of allocations */
+void alloc_count_start(void);
+guint64 alloc_count_stop(void);
+
+/* Create a FIFO at path, and open it as a joystick with the given number
+ * of axes and buttons; js_event records written to *wfd are then issued
+ * as signals, like those of a real joystick. Returns NULL, with errno
+ * set, if that fails. */
+JoyStick* fifo_stick_open(const gchar* path, guint8 naxes, guint8 nbuttons, int* wfd);
+
+/* Fill evs with count synthetic events for a joystick with the given
+ * number of axes and buttons, continuing a stream at event number seq:
+ * every fourth event is a button, the others move the axes; every event
+ * has a timestamp of its own, so that every event is a report. */
+void js_event_fill(struct js_event* evs, gint count, guint64 seq, guint8 naxes, guint8 nbuttons);
+
+G_END_DECLS
+
+#endif // LIBJOY_BENCH_UTIL_H
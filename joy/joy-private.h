@@ -0,0 +1,180 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef LIBJOY_PRIVATE_H
+#define LIBJOY_PRIVATE_H
+
+/* Functions shared between the parts of libjoy, but not part of its API */
+
+#include <joy/joystick.h>
+
+#include <libudev.h>
+
+G_BEGIN_DECLS
+
+#define JOY_NAME_LEN 128
+
+/* The types of a JoyEvent */
+enum {
+	JOY_EVENT_NONE,
+	JOY_EVENT_BUTTON,
+	JOY_EVENT_AXIS,
+	/* end of a report of the hardware */
+	JOY_EVENT_SYNC,
+};
+
+/* JoyEvent flags: the event is part of a dump of the complete state of
+ * the device, rather than a change */
+#define JOY_EVENT_INIT 0x01
+/* Set by the core on the SYNC that ends a state dump after an overflow */
+#define JOY_EVENT_RESYNC 0x02
+
+typedef struct _JoyEvent JoyEvent;
+
+/* An event in the format of the core, whatever the backend; time is in
+ * microseconds, number is the index of the axis or button. rtime is when
+ * the event was read, if latency statistics are enabled, or 0; backends
+ * need not fill it in. */
+struct _JoyEvent {
+	gint64 time;
+	gint64 rtime;
+	gint32 value;
+	guint8 type;
+	guint8 number;
+	guint8 flags;
+};
+
+typedef struct _JoyDeviceInfo JoyDeviceInfo;
+
+/* What a backend found out about a device when opening it */
+struct _JoyDeviceInfo {
+	guint8 naxes;
+	guint8 nbuts;
+	guint8 axmap[JOY_STICK_MAX_AXES];
+	guint16 butmap[JOY_STICK_MAX_BUTTONS];
+	gint32 axmin[JOY_STICK_MAX_AXES];
+	gint32 axmax[JOY_STICK_MAX_AXES];
+	/* The state of the device when it was opened, for backends that
+	 * can query it; others leave it at 0 and send a state dump */
+	gint32 axval[JOY_STICK_MAX_AXES];
+	guint64 buttons[JOY_STICK_MAX_BUTTONS / 64];
+	gchar name[JOY_NAME_LEN];
+};
+
+/* The maximum number of events a backend may produce from count records:
+ * one sync event per record if every record is a report of its own, plus
+ * one dump of the state of the device, e.g. to resynchronize after the
+ * kernel dropped events */
+#define JOY_BACKEND_MAX_EVENTS(count) (2 * (count) + JOY_STICK_MAX_AXES + JOY_STICK_MAX_BUTTONS + 1)
+
+typedef struct _JoyBackend JoyBackend;
+
+/* An interface to read joystick events from: a kernel interface, or
+ * something that behaves like one.
+ *
+ * prefix: (optional) device nodes that start with this string belong to
+ * this backend, which opens them with open() rather than the core with
+ * open(2). Backends without a prefix are probed, in order, for all other
+ * device nodes.
+ * open: (required with prefix) return a file descriptor that becomes
+ * readable when records are available, and that reads as end of file
+ * when the device goes away; or -1, with errno set. May store private
+ * data in *data, which is then passed to probe.
+ * probe: find out whether fd is a device of this kind, and fill in info;
+ * may store private data in *data.
+ * convert: translate count records of record_size bytes into at most
+ * JOY_BACKEND_MAX_EVENTS(count) events, ending every report of the
+ * hardware with a JOY_EVENT_SYNC event; returns the number of events.
+ * grab: (optional) take exclusive access to the device, or release it.
+ * free: (optional) free the private data. */
+struct _JoyBackend {
+	const gchar* name;
+	gsize record_size;
+	const gchar* prefix;
+	int (*open)(const gchar* devnode, gpointer* data);
+	gboolean (*probe)(int fd, JoyDeviceInfo* info, gpointer* data);
+	gsize (*convert)(gpointer data, int fd, const void* records, gsize count, JoyEvent* events);
+	gboolean (*grab)(gpointer data, int fd, gboolean grab);
+	void (*free)(gpointer data);
+};
+
+typedef struct _JoyRecord JoyRecord;
+
+/* An event as it is passed through the pipe of a JoyVirtual or a
+ * JoyPlayer, and stored in a recording. Its size is a power of two, so
+ * that records are never split across the buffers of a JoyHub, and are
+ * aligned in a mapped file. */
+struct _JoyRecord {
+	gint64 time;
+	gint32 value;
+	guint8 type;
+	guint8 number;
+	guint8 flags;
+	guint8 pad;
+};
+
+/* Helpers for backends that feed records to the JoyStick through a pipe
+ * (see joyvirtual.c): create the pipe; discard what the JoyStick has not
+ * read yet, and queue a dump of the given state instead; do that, and
+ * return a new reading end for a JoyStick; write as many records as fit
+ * without blocking; and the convert function. */
+int _joy_record_pipe(int fds[2]);
+void _joy_record_reset(int rfd, int wfd, guint8 naxes, const gint32* axes, guint8 nbuts, const guint64* buttons);
+int _joy_record_open(int rfd, int wfd, guint8 naxes, const gint32* axes, guint8 nbuts, const guint64* buttons);
+gsize _joy_record_write(int fd, const JoyRecord* recs, gsize count);
+gsize _joy_record_convert(gpointer data, int fd, const void* records, gsize count, JoyEvent* events);
+
+extern const JoyBackend _joy_backend_joydev;
+extern const JoyBackend _joy_backend_evdev;
+extern const JoyBackend _joy_backend_virtual;
+extern const JoyBackend _joy_backend_replay;
+
+int _joy_stick_get_fd(JoyStick* self);
+gboolean _joy_stick_handle_events(JoyStick* self, GIOCondition cond);
+void _joy_stick_set_hub(JoyStick* self, gpointer hub);
+/* Called by a joystick in a hub when it opened its device again */
+void _joy_hub_update_fd(gpointer hub, JoyStick* stick);
+/* Have tap called with every batch of events the backend produces, on
+ * the thread that reads from the device, right after the batch was
+ * recorded in the state (so events that change nothing are
+ * JOY_EVENT_NONE); or stop with a NULL tap. Only one tap can be set at a
+ * time; returns FALSE if there already is one. The state that the first
+ * batch passed to tap starts from is copied to axes and buttons (of
+ * JOY_STICK_MAX_AXES and JOY_STICK_MAX_BUTTONS / 64 elements), if not
+ * NULL, before tap can be called. */
+typedef void (*JoyStickTap)(gpointer data, const JoyEvent* evs, gsize count);
+gboolean _joy_stick_set_tap(JoyStick* self, JoyStickTap tap, gpointer data, gint32* axes, guint64* buttons);
+void _joy_stick_process_records(JoyStick* self, const void* records, gsize size);
+gboolean _joy_stick_is_preferred_node(struct udev_device* dev);
+/* Reconnecting persistent joysticks (see #JoyStick:persistent): the
+ * identity of a device, as a newly allocated string or NULL; the
+ * disconnected joystick that waits for the device with that identity, if
+ * any; and bind such a joystick to the device node where its device
+ * reappeared, at the given g_get_monotonic_time(). */
+gchar* _joy_device_identity(struct udev_device* dev);
+JoyStick* _joy_stick_lookup_lost(const gchar* identity);
+gboolean _joy_stick_rebind(JoyStick* self, const gchar* devnode, gint64 appeared);
+/* Give a device that has no layout of its own (e.g., a FIFO) the given
+ * number of axes and buttons, so that it issues signals; for the
+ * benchmarks. Not for use in %JOY_MODE_THREAD mode. */
+void _joy_stick_set_layout(JoyStick* self, guint8 naxes, guint8 nbuts);
+
+G_END_DECLS
+
+#endif // LIBJOY_PRIVATE_H
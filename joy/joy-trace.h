@@ -0,0 +1,123 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef LIBJOY_TRACE_H
+#define LIBJOY_TRACE_H
+
+/* Static tracepoints. With USDT support (<sys/sdt.h>), every point is a
+ * probe in the "libjoy" provider that costs a single nop until a tracer
+ * attaches to it, e.g.:
+ *
+ *	bpftrace -e 'usdt:/usr/lib/libjoy-1.0.so:libjoy:emit__end { ... }'
+ *
+ * With sysprof-capture, the emission of signals is also recorded as a
+ * mark while sysprof is recording. With --disable-tracing, all of this
+ * compiles to nothing.
+ *
+ * Probes and their arguments:
+ *	open(devnode)			joy_stick_open() created a new object
+ *	reopen(devnode, fd, backend)	the device node was (re)opened
+ *	read(devnode, records, events)	records were read and converted
+ *	emit__begin(devnode, signal, number, value)
+ *	emit__end(devnode, signal, number, value)
+ *	disconnect(devnode)		the device went away
+ *	reconnect(devnode, latency)	a persistent joystick was rebound,
+ *					latency microseconds after udev
+ *					reported its device
+ *
+ * signal is one of the JOY_TRACE_SIGNAL_* values below. */
+
+#include <glib.h>
+
+enum {
+	JOY_TRACE_SIGNAL_BUTTON_PRESSED,
+	JOY_TRACE_SIGNAL_BUTTON_RELEASED,
+	JOY_TRACE_SIGNAL_AXIS_MOVED,
+	JOY_TRACE_SIGNAL_REPORT,
+};
+
+#ifdef JOY_ENABLE_TRACING
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define JOY_PROBE1(name, a) DTRACE_PROBE1(libjoy, name, a)
+#define JOY_PROBE2(name, a, b) DTRACE_PROBE2(libjoy, name, a, b)
+#define JOY_PROBE3(name, a, b, c) DTRACE_PROBE3(libjoy, name, a, b, c)
+#define JOY_PROBE4(name, a, b, c, d) DTRACE_PROBE4(libjoy, name, a, b, c, d)
+#else
+#define JOY_PROBE1(name, a) G_STMT_START { } G_STMT_END
+#define JOY_PROBE2(name, a, b) G_STMT_START { } G_STMT_END
+#define JOY_PROBE3(name, a, b, c) G_STMT_START { } G_STMT_END
+#define JOY_PROBE4(name, a, b, c, d) G_STMT_START { } G_STMT_END
+#endif
+
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+
+static const char* const joy_trace_signal_names[] = {
+	"button-pressed",
+	"button-released",
+	"axis-moved",
+	"report",
+};
+#endif
+
+#define JOY_TRACE_OPEN(devnode) JOY_PROBE1(open, devnode)
+#define JOY_TRACE_REOPEN(devnode, fd, backend) JOY_PROBE3(reopen, devnode, fd, backend)
+#define JOY_TRACE_READ(devnode, records, events) JOY_PROBE3(read, devnode, records, events)
+#define JOY_TRACE_DISCONNECT(devnode) JOY_PROBE1(disconnect, devnode)
+#define JOY_TRACE_RECONNECT(devnode, latency) JOY_PROBE2(reconnect, devnode, latency)
+
+/* Returns the time at which the emission started, for joy_trace_emit_end() */
+static inline gint64 joy_trace_emit_begin(const gchar* devnode, gint signal, gint number, gint value) {
+	JOY_PROBE4(emit__begin, devnode, signal, number, value);
+#ifdef HAVE_SYSPROF
+	return SYSPROF_CAPTURE_CURRENT_TIME;
+#else
+	return 0;
+#endif
+}
+
+static inline void joy_trace_emit_end(const gchar* devnode, gint signal, gint number, gint value, gint64 begin) {
+	JOY_PROBE4(emit__end, devnode, signal, number, value);
+#ifdef HAVE_SYSPROF
+	sysprof_collector_mark(begin, SYSPROF_CAPTURE_CURRENT_TIME - begin, "libjoy", joy_trace_signal_names[signal], devnode);
+#else
+	(void)begin;
+#endif
+}
+
+#else /* !JOY_ENABLE_TRACING */
+
+#define JOY_TRACE_OPEN(devnode) G_STMT_START { } G_STMT_END
+#define JOY_TRACE_REOPEN(devnode, fd, backend) G_STMT_START { } G_STMT_END
+#define JOY_TRACE_READ(devnode, records, events) G_STMT_START { } G_STMT_END
+#define JOY_TRACE_DISCONNECT(devnode) G_STMT_START { } G_STMT_END
+#define JOY_TRACE_RECONNECT(devnode, latency) G_STMT_START { } G_STMT_END
+
+static inline gint64 joy_trace_emit_begin(const gchar* devnode G_GNUC_UNUSED, gint signal G_GNUC_UNUSED, gint number G_GNUC_UNUSED, gint value G_GNUC_UNUSED) {
+	return 0;
+}
+
+static inline void joy_trace_emit_end(const gchar* devnode G_GNUC_UNUSED, gint signal G_GNUC_UNUSED, gint number G_GNUC_UNUSED, gint value G_GNUC_UNUSED, gint64 begin G_GNUC_UNUSED) {
+}
+
+#endif /* JOY_ENABLE_TRACING */
+
+#endif /* LIBJOY_TRACE_H */
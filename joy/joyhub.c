@@ -0,0 +1,633 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include <linux/input.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include <joy/joyhub.h>
+#include "joy-private.h"
+
+/**
+  * SECTION:joyhub
+  * @short_description: one event loop for many joysticks
+  * @see_also: #JoyStick
+  * @stability: Unstable
+  * @include: joy/joyhub.h
+  *
+  * A #JoyHub watches any number of #JoyStick objects through a single
+  * epoll file descriptor. Rather than adding one #GSource per joystick
+  * to the main loop, an application adds the one #GSource returned by
+  * joy_hub_create_source(), or runs joy_hub_run() in a thread of its own;
+  * either way, the cost of waiting for events does not depend on the
+  * number of joysticks.
+  *
+  * On systems with many joysticks, a hub created with
+  * joy_hub_new_with_backend() and %JOY_HUB_BACKEND_IO_URING does not even
+  * need a read() call per device: the kernel writes the events of all
+  * devices into one shared set of buffers, and the hub handles all of
+  * them after a single wakeup.
+  */
+
+/* The maximum number of ready devices handled per epoll_wait() */
+#define MAX_EVENTS 64
+
+#ifdef HAVE_LIBURING
+/* Size of the io_uring submission queue, the number of buffers in the
+ * shared buffer ring (must be a power of two), and the size of one
+ * buffer (a multiple of the record size of every backend, so that no
+ * record is split across buffers). The buffer group ID is
+ * arbitrary, as we only use one. */
+#define URING_ENTRIES 256
+#define URING_NBUFS 256
+#define URING_BUFSZ (64 * sizeof(struct input_event))
+#define URING_BGID 0
+
+typedef struct _JoyHubSlot JoyHubSlot;
+
+/* One outstanding read request. The stick is cleared when it is removed
+ * from the hub while the request is still in flight, or while its
+ * completion is being handled; the slot is freed once neither is the
+ * case anymore. */
+struct _JoyHubSlot {
+	JoyStick* stick;
+	int fd;
+	gboolean armed;
+	gboolean reaping;
+};
+#endif
+
+struct _JoyHubPrivate {
+	int epfd;
+	GHashTable* sticks;
+	JoyHubBackend backend;
+#ifdef HAVE_LIBURING
+	struct io_uring ring;
+	struct io_uring_buf_ring* bufring;
+	guchar* bufs;
+	gboolean multishot;
+	GSList* zombies;
+#endif
+};
+
+static GObjectClass* parent_class = NULL;
+
+typedef struct _JoyHubSource JoyHubSource;
+
+struct _JoyHubSource {
+	GSource source;
+	JoyHub* hub;
+	gpointer tag;
+};
+
+/** 
+  * joy_hub_new: (constructor)
+  *
+  * Create a new, empty, #JoyHub.
+  *
+  * Returns: a newly-allocated #JoyHub.
+  */
+JoyHub* joy_hub_new(void) {
+	return g_object_new(JOY_TYPE_HUB, NULL);
+}
+
+#ifdef HAVE_LIBURING
+static gboolean joy_hub_uring_init(JoyHub* self) {
+	JoyHubPrivate* priv = self->priv;
+	struct epoll_event ev;
+	int rv;
+
+	rv = io_uring_queue_init(URING_ENTRIES, &priv->ring, 0);
+	if(rv < 0) {
+		g_debug("io_uring not available (%s), falling back to epoll", g_strerror(-rv));
+		return FALSE;
+	}
+	priv->bufring = io_uring_setup_buf_ring(&priv->ring, URING_NBUFS, URING_BGID, 0, &rv);
+	if(!priv->bufring) {
+		g_debug("io_uring buffer rings not available (%s), falling back to epoll", g_strerror(-rv));
+		io_uring_queue_exit(&priv->ring);
+		return FALSE;
+	}
+	priv->bufs = g_malloc(URING_NBUFS * URING_BUFSZ);
+	for(int i=0; i<URING_NBUFS; i++) {
+		io_uring_buf_ring_add(priv->bufring, priv->bufs + i * URING_BUFSZ, URING_BUFSZ, i, io_uring_buf_ring_mask(URING_NBUFS), i);
+	}
+	io_uring_buf_ring_advance(priv->bufring, URING_NBUFS);
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+	{
+		struct io_uring_probe* probe = io_uring_get_probe_ring(&priv->ring);
+		if(probe) {
+			priv->multishot = io_uring_opcode_supported(probe, IORING_OP_READ_MULTISHOT);
+			io_uring_free_probe(probe);
+		}
+	}
+#endif
+	/* Completions wake up the epoll set, so that the GSource and
+	 * joy_hub_run() need not care which backend is in use. The ring
+	 * itself is the marker to recognize it by. */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &priv->ring;
+	if(epoll_ctl(priv->epfd, EPOLL_CTL_ADD, priv->ring.ring_fd, &ev) < 0) {
+		io_uring_free_buf_ring(&priv->ring, priv->bufring, URING_NBUFS, URING_BGID);
+		io_uring_queue_exit(&priv->ring);
+		g_free(priv->bufs);
+		priv->bufs = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void joy_hub_uring_arm(JoyHub* self, JoyHubSlot* slot) {
+	struct io_uring_sqe* sqe = io_uring_get_sqe(&self->priv->ring);
+
+	if(!sqe) {
+		io_uring_submit(&self->priv->ring);
+		sqe = io_uring_get_sqe(&self->priv->ring);
+	}
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+	if(self->priv->multishot) {
+		io_uring_prep_read_multishot(sqe, slot->fd, 0, 0, URING_BGID);
+	} else
+#endif
+	{
+		io_uring_prep_read(sqe, slot->fd, NULL, URING_BUFSZ, 0);
+		sqe->flags |= IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BGID;
+	}
+	io_uring_sqe_set_data(sqe, slot);
+	slot->armed = TRUE;
+}
+
+static void joy_hub_uring_cancel(JoyHub* self, JoyHubSlot* slot) {
+	struct io_uring_sqe* sqe;
+
+	slot->stick = NULL;
+	if(slot->armed) {
+		sqe = io_uring_get_sqe(&self->priv->ring);
+		if(!sqe) {
+			io_uring_submit(&self->priv->ring);
+			sqe = io_uring_get_sqe(&self->priv->ring);
+		}
+		io_uring_prep_cancel(sqe, slot, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+		io_uring_submit(&self->priv->ring);
+	} else if(!slot->reaping) {
+		g_free(slot);
+		return;
+	}
+	self->priv->zombies = g_slist_prepend(self->priv->zombies, slot);
+}
+
+static JoyHubSlot* joy_hub_uring_watch(JoyHub* self, JoyStick* stick, int fd) {
+	JoyHubSlot* slot = g_new0(JoyHubSlot, 1);
+
+	slot->stick = stick;
+	slot->fd = fd;
+	joy_hub_uring_arm(self, slot);
+	io_uring_submit(&self->priv->ring);
+	return slot;
+}
+
+static void joy_hub_uring_reap(JoyHub* self) {
+	JoyHubPrivate* priv = self->priv;
+	struct io_uring_cqe* cqe;
+	unsigned head;
+	unsigned seen = 0;
+	int recycled = 0;
+
+	g_object_ref(self);
+	io_uring_for_each_cqe(&priv->ring, head, cqe) {
+		JoyHubSlot* slot = io_uring_cqe_get_data(cqe);
+		JoyStick* stick;
+
+		seen++;
+		/* completion of a cancel request */
+		if(!slot) {
+			continue;
+		}
+		stick = slot->stick;
+		if(!(cqe->flags & IORING_CQE_F_MORE)) {
+			slot->armed = FALSE;
+		}
+		if(cqe->flags & IORING_CQE_F_BUFFER) {
+			int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			guchar* buf = priv->bufs + bid * URING_BUFSZ;
+
+			if(stick && cqe->res > 0) {
+				slot->reaping = TRUE;
+				_joy_stick_process_records(stick, buf, cqe->res);
+				slot->reaping = FALSE;
+			}
+			io_uring_buf_ring_add(priv->bufring, buf, URING_BUFSZ, bid, io_uring_buf_ring_mask(URING_NBUFS), recycled++);
+		}
+		if(!slot->stick) {
+			/* removed from the hub, possibly by a signal handler
+			 * we just ran */
+			if(!slot->armed) {
+				priv->zombies = g_slist_remove(priv->zombies, slot);
+				g_free(slot);
+			}
+			continue;
+		}
+		if(cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EAGAIN && cqe->res != -EINTR)) {
+			/* The device went away */
+			g_object_ref(stick);
+			if(!_joy_stick_handle_events(stick, G_IO_HUP)) {
+				joy_hub_remove(self, stick);
+			}
+			g_object_unref(stick);
+			continue;
+		}
+		if(!slot->armed) {
+			joy_hub_uring_arm(self, slot);
+		}
+	}
+	io_uring_cq_advance(&priv->ring, seen);
+	if(recycled) {
+		io_uring_buf_ring_advance(priv->bufring, recycled);
+	}
+	io_uring_submit(&priv->ring);
+	g_object_unref(self);
+}
+#endif
+
+/** 
+  * joy_hub_new_with_backend: (constructor)
+  * @backend: the #JoyHubBackend to use
+  *
+  * Create a new, empty, #JoyHub which reads from its joysticks through
+  * @backend.
+  *
+  * If @backend is %JOY_HUB_BACKEND_IO_URING, but libjoy was built without
+  * io_uring support or the running kernel does not support it (io_uring
+  * buffer rings require Linux 5.19), the hub silently falls back to
+  * %JOY_HUB_BACKEND_EPOLL; use joy_hub_get_backend() to find out which
+  * backend is in use.
+  *
+  * Returns: a newly-allocated #JoyHub.
+  */
+JoyHub* joy_hub_new_with_backend(JoyHubBackend backend) {
+	JoyHub* self = g_object_new(JOY_TYPE_HUB, NULL);
+
+#ifdef HAVE_LIBURING
+	if(backend == JOY_HUB_BACKEND_IO_URING && joy_hub_uring_init(self)) {
+		self->priv->backend = JOY_HUB_BACKEND_IO_URING;
+	}
+#endif
+	return self;
+}
+
+/** 
+  * joy_hub_get_backend:
+  * @self: a #JoyHub
+  *
+  * Returns: the #JoyHubBackend that @self actually uses.
+  */
+JoyHubBackend joy_hub_get_backend(JoyHub* self) {
+	return self->priv->backend;
+}
+
+/** 
+  * joy_hub_add:
+  * @self: a #JoyHub
+  * @stick: the #JoyStick to add
+  *
+  * Add a joystick to the hub. From then on, the hub issues the events of
+  * @stick, regardless of the #JoyMode of @stick; the hub keeps a
+  * reference to @stick until it is removed again, or until it is
+  * disconnected.
+  *
+  * Note that axis events which are held back due to the
+  * #JoyStick:axis-interval property are still issued from the main context
+  * of @stick.
+  *
+  * Returns: %TRUE if the joystick was added, or %FALSE if it is not open.
+  */
+gboolean joy_hub_add(JoyHub* self, JoyStick* stick) {
+	struct epoll_event ev;
+	int fd = _joy_stick_get_fd(stick);
+
+	if(fd < 0) {
+		return FALSE;
+	}
+	if(g_hash_table_contains(self->priv->sticks, stick)) {
+		return TRUE;
+	}
+#ifdef HAVE_LIBURING
+	if(self->priv->backend == JOY_HUB_BACKEND_IO_URING) {
+		/* The device stays non-blocking: joydev and evdev cannot
+		 * do non-blocking reads for io_uring otherwise, so it
+		 * would park a kernel worker thread in a blocking read for
+		 * every device. This way, io_uring waits for the device to
+		 * become readable, and only then reads from it. */
+		_joy_stick_set_hub(stick, self);
+		g_hash_table_insert(self->priv->sticks, g_object_ref(stick), joy_hub_uring_watch(self, stick, fd));
+		return TRUE;
+	}
+#endif
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = stick;
+	if(epoll_ctl(self->priv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		g_warning("Could not add %s to hub: %s", joy_stick_get_devnode(stick), g_strerror(errno));
+		return FALSE;
+	}
+	g_hash_table_add(self->priv->sticks, g_object_ref(stick));
+	_joy_stick_set_hub(stick, self);
+	return TRUE;
+}
+
+/** 
+  * joy_hub_remove:
+  * @self: a #JoyHub
+  * @stick: the #JoyStick to remove
+  *
+  * Remove a joystick from the hub. The joystick will issue its events
+  * according to its #JoyMode again.
+  */
+void joy_hub_remove(JoyHub* self, JoyStick* stick) {
+	int fd;
+
+	if(!g_hash_table_contains(self->priv->sticks, stick)) {
+		return;
+	}
+#ifdef HAVE_LIBURING
+	if(self->priv->backend == JOY_HUB_BACKEND_IO_URING) {
+		joy_hub_uring_cancel(self, g_hash_table_lookup(self->priv->sticks, stick));
+	} else
+#endif
+	{
+		fd = _joy_stick_get_fd(stick);
+		if(fd >= 0) {
+			epoll_ctl(self->priv->epfd, EPOLL_CTL_DEL, fd, NULL);
+		}
+	}
+	g_hash_table_remove(self->priv->sticks, stick);
+	_joy_stick_set_hub(stick, NULL);
+	g_object_unref(stick);
+}
+
+/* The device of a joystick in the hub was opened again, e.g. by
+ * _joy_stick_rebind(); closing the old fd took it out of the epoll set,
+ * but not out of an io_uring read request */
+void _joy_hub_update_fd(gpointer hub, JoyStick* stick) {
+	JoyHub* self = JOY_HUB(hub);
+	struct epoll_event ev;
+	int fd = _joy_stick_get_fd(stick);
+
+	if(fd < 0 || !g_hash_table_contains(self->priv->sticks, stick)) {
+		return;
+	}
+#ifdef HAVE_LIBURING
+	if(self->priv->backend == JOY_HUB_BACKEND_IO_URING) {
+		joy_hub_uring_cancel(self, g_hash_table_lookup(self->priv->sticks, stick));
+		g_hash_table_insert(self->priv->sticks, stick, joy_hub_uring_watch(self, stick, fd));
+		return;
+	}
+#endif
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = stick;
+	if(epoll_ctl(self->priv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0 && (errno != EEXIST || epoll_ctl(self->priv->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)) {
+		g_warning("Could not add %s to hub: %s", joy_stick_get_devnode(stick), g_strerror(errno));
+	}
+}
+
+/** 
+  * joy_hub_get_stick_count:
+  * @self: a #JoyHub
+  *
+  * Returns: the number of joysticks in the hub.
+  */
+guint joy_hub_get_stick_count(JoyHub* self) {
+	return g_hash_table_size(self->priv->sticks);
+}
+
+static void joy_hub_dispatch_ready(JoyHub* self, struct epoll_event* events, int count) {
+	for(int i=0; i<count; i++) {
+		JoyStick* stick = events[i].data.ptr;
+		GIOCondition cond = 0;
+
+#ifdef HAVE_LIBURING
+		if(stick == (gpointer)&self->priv->ring) {
+			joy_hub_uring_reap(self);
+			continue;
+		}
+#endif
+		/* A handler for an earlier device may have removed this one */
+		if(!stick || !g_hash_table_contains(self->priv->sticks, stick)) {
+			continue;
+		}
+		if(events[i].events & EPOLLIN) {
+			cond |= G_IO_IN;
+		}
+		if(events[i].events & EPOLLERR) {
+			cond |= G_IO_ERR;
+		}
+		if(events[i].events & EPOLLHUP) {
+			cond |= G_IO_HUP;
+		}
+		g_object_ref(stick);
+		if(!_joy_stick_handle_events(stick, cond)) {
+			joy_hub_remove(self, stick);
+		}
+		g_object_unref(stick);
+	}
+}
+
+static gboolean joy_hub_source_dispatch(GSource* source, GSourceFunc callback G_GNUC_UNUSED, gpointer user_data G_GNUC_UNUSED) {
+	JoyHub* self = ((JoyHubSource*)source)->hub;
+	struct epoll_event events[MAX_EVENTS];
+	int count;
+
+	count = epoll_wait(self->priv->epfd, events, MAX_EVENTS, 0);
+	if(count > 0) {
+		g_object_ref(self);
+		joy_hub_dispatch_ready(self, events, count);
+		g_object_unref(self);
+	}
+	return TRUE;
+}
+
+static void joy_hub_source_finalize(GSource* source) {
+	g_object_unref(((JoyHubSource*)source)->hub);
+}
+
+static GSourceFuncs joy_hub_source_funcs = {
+	NULL,	/* prepare */
+	NULL,	/* check */
+	joy_hub_source_dispatch,
+	joy_hub_source_finalize,
+};
+
+/** 
+  * joy_hub_create_source:
+  * @self: a #JoyHub
+  *
+  * Create a #GSource which issues the events of all joysticks in the hub.
+  * The source must be attached to a #GMainContext with g_source_attach()
+  * before it does anything.
+  *
+  * Every time the source is dispatched, it handles up to 64 devices with
+  * pending events, reading all of their pending events.
+  *
+  * Returns: (transfer full): a new #GSource
+  */
+GSource* joy_hub_create_source(JoyHub* self) {
+	GSource* source = g_source_new(&joy_hub_source_funcs, sizeof(JoyHubSource));
+	JoyHubSource* hsource = (JoyHubSource*)source;
+
+	hsource->hub = g_object_ref(self);
+	hsource->tag = g_source_add_unix_fd(source, self->priv->epfd, G_IO_IN);
+	g_source_set_name(source, "JoyHub");
+	return source;
+}
+
+/** 
+  * joy_hub_run:
+  * @self: a #JoyHub
+  * @cancellable: (allow-none): a #GCancellable, or %NULL
+  * @err: return location for a #GError, or %NULL
+  *
+  * Wait for and issue the events of all joysticks in the hub, until
+  * @cancellable is cancelled. The signals of the joysticks are issued from
+  * the thread that calls this function.
+  *
+  * Returns: %FALSE, with @err set to %G_IO_ERROR_CANCELLED when
+  * @cancellable was cancelled, or to another error if waiting for events
+  * failed.
+  */
+gboolean joy_hub_run(JoyHub* self, GCancellable* cancellable, GError** err) {
+	struct epoll_event events[MAX_EVENTS];
+	int cfd = -1;
+
+	if(cancellable && (cfd = g_cancellable_get_fd(cancellable)) >= 0) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		epoll_ctl(self->priv->epfd, EPOLL_CTL_ADD, cfd, &ev);
+	}
+	g_object_ref(self);
+	while(!g_cancellable_set_error_if_cancelled(cancellable, err)) {
+		int count = epoll_wait(self->priv->epfd, events, MAX_EVENTS, -1);
+		if(count < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			g_set_error(err, G_IO_ERROR, g_io_error_from_errno(errno), "Could not wait for joystick events: %s", g_strerror(errno));
+			break;
+		}
+		joy_hub_dispatch_ready(self, events, count);
+	}
+	if(cfd >= 0) {
+		epoll_ctl(self->priv->epfd, EPOLL_CTL_DEL, cfd, NULL);
+		g_cancellable_release_fd(cancellable);
+	}
+	g_object_unref(self);
+	return FALSE;
+}
+
+static void instance_init(GTypeInstance* instance, gpointer g_class G_GNUC_UNUSED) {
+	JoyHub *self = JOY_HUB(instance);
+
+	self->priv = g_new0(JoyHubPrivate, 1);
+	self->priv->epfd = epoll_create1(EPOLL_CLOEXEC);
+	self->priv->sticks = g_hash_table_new(g_direct_hash, g_direct_equal);
+	self->priv->backend = JOY_HUB_BACKEND_EPOLL;
+}
+
+static void finalize(GObject* object) {
+	JoyHub* self = JOY_HUB(object);
+	GHashTableIter iter;
+	gpointer stick;
+	gpointer slot;
+
+#ifdef HAVE_LIBURING
+	if(self->priv->backend == JOY_HUB_BACKEND_IO_URING) {
+		/* Tearing down the ring cancels all outstanding requests, so
+		 * only then is it safe to free their slots, and to let the
+		 * joysticks read from their devices again */
+		io_uring_free_buf_ring(&self->priv->ring, self->priv->bufring, URING_NBUFS, URING_BGID);
+		io_uring_queue_exit(&self->priv->ring);
+		g_free(self->priv->bufs);
+		g_slist_free_full(self->priv->zombies, g_free);
+	}
+#endif
+	g_hash_table_iter_init(&iter, self->priv->sticks);
+	while(g_hash_table_iter_next(&iter, &stick, &slot)) {
+		_joy_stick_set_hub(JOY_STICK(stick), NULL);
+		g_object_unref(stick);
+#ifdef HAVE_LIBURING
+		/* With epoll, there is no slot; the key is the value */
+		if(self->priv->backend == JOY_HUB_BACKEND_IO_URING) {
+			g_free(slot);
+		}
+#endif
+	}
+	g_hash_table_destroy(self->priv->sticks);
+	if(self->priv->epfd >= 0) {
+		close(self->priv->epfd);
+	}
+	g_free(self->priv);
+	parent_class->finalize(object);
+}
+
+static void class_init(gpointer g_class, gpointer g_class_data G_GNUC_UNUSED) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(g_class);
+
+	parent_class = g_type_class_peek_parent(g_class);
+	gobject_class->finalize = finalize;
+}
+
+GType joy_hub_get_type(void) {
+	static GType type = 0;
+	if(!type) {
+		static const GTypeInfo info = {
+			sizeof(JoyHubClass),
+			NULL,	/* base_init */
+			NULL,	/* base_finalize */
+			class_init,	/* class_init */
+			NULL,	/* class_finalize */
+			NULL,	/* class_data */
+			sizeof(JoyHub),
+			0,	/* n_preallocs */
+			instance_init,
+		};
+		type = g_type_register_static(G_TYPE_OBJECT,
+					      "JoyHub",
+					      &info, 0);
+	}
+
+	return type;
+}
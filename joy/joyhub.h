@@ -0,0 +1,91 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef LIBJOY_HUB_H
+#define LIBJOY_HUB_H
+
+#include <joy/joystick.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define JOY_TYPE_HUB		(joy_hub_get_type())
+#define JOY_HUB(obj)		(G_TYPE_CHECK_INSTANCE_CAST((obj), JOY_TYPE_HUB, JoyHub))
+#define JOY_HUB_CLASS(vtable)	(G_TYPE_CHECK_CLASS_CAST((vtable), JOY_TYPE_HUB, JoyHubClass))
+#define JOY_IS_HUB(obj)		(G_TYPE_CHECK_INSTANCE_TYPE((obj), JOY_TYPE_HUB))
+#define JOY_IS_HUB_CLASS(vtable)	(G_TYPE_CHECK_CLASS_TYPE((vtable), JOY_TYPE_HUB))
+#define JOY_HUB_GET_CLASS(inst)	(G_TYPE_INSTANCE_GET_CLASS((inst), JOY_TYPE_HUB, JoyHubClass))
+
+/**
+  * JoyHubBackend:
+  * @JOY_HUB_BACKEND_EPOLL: wait for the devices with epoll, and read()
+  * each device that has pending events.
+  * @JOY_HUB_BACKEND_IO_URING: keep a read request queued through io_uring
+  * for every device, so that the kernel fills a shared set of buffers
+  * without any per-device system calls. Only available if libjoy was
+  * configured with --enable-io-uring.
+  *
+  * The mechanism a #JoyHub uses to read from its joysticks.
+  */
+typedef enum {
+	JOY_HUB_BACKEND_EPOLL,
+	JOY_HUB_BACKEND_IO_URING,
+} JoyHubBackend;
+
+typedef struct _JoyHub JoyHub;
+typedef struct _JoyHubClass JoyHubClass;
+typedef struct _JoyHubPrivate JoyHubPrivate;
+
+/**
+  * JoyHub:
+  *
+  * Opaque object representing a set of joysticks which share one event
+  * loop
+  */
+struct _JoyHub {
+	/*< private >*/
+	GObject parent;
+	JoyHubPrivate *priv;
+};
+
+/**
+  * JoyHubClass:
+  */
+struct _JoyHubClass {
+	/*< private >*/
+	GObjectClass parent;
+};
+
+/* constructors */
+JoyHub* joy_hub_new(void);
+JoyHub* joy_hub_new_with_backend(JoyHubBackend backend);
+/* instance functions */
+gboolean joy_hub_add(JoyHub* self, JoyStick* stick);
+void joy_hub_remove(JoyHub* self, JoyStick* stick);
+guint joy_hub_get_stick_count(JoyHub* self);
+JoyHubBackend joy_hub_get_backend(JoyHub* self);
+GSource* joy_hub_create_source(JoyHub* self);
+gboolean joy_hub_run(JoyHub* self, GCancellable* cancellable, GError** err);
+
+/* type handling functions */
+GType joy_hub_get_type(void) G_GNUC_PURE;
+
+G_END_DECLS
+
+#endif // LIBJOY_HUB_H
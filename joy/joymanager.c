@@ -0,0 +1,498 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <libudev.h>
+
+#include <glib-unix.h>
+
+#include <joy/joymanager.h>
+#include "joy-private.h"
+
+/**
+  * SECTION:joymanager
+  * @short_description: keep track of the joysticks on the system
+  * @see_also: #JoyStick, joy_stick_enumerate()
+  * @stability: Unstable
+  * @include: joy/joymanager.h
+  *
+  * The #JoyManager returned by joy_manager_get_default() knows which
+  * joysticks are plugged in, and tells whoever is interested when that
+  * changes, through the #JoyManager::device-added and
+  * #JoyManager::device-removed signals. There is only one per process,
+  * with one connection to udev, however many parts of a program want to
+  * know about joysticks.
+  *
+  * Plugging in a device, resetting a USB hub, or a driver that takes a
+  * while to set up a device, tends to produce many udev events in a short
+  * time. Rather than acting on each of them, the #JoyManager collects
+  * them for #JoyManager:batch-interval milliseconds, and then only acts
+  * on the net result: a device that came and went within that time is
+  * never opened, and each device is reported at most once per batch.
+  *
+  * The #JoyManager handles udev events in the global default
+  * #GMainContext, and issues its signals there.
+  *
+  * The #JoyManager also reconnects #JoyStick:persistent joysticks. That
+  * does not wait for the end of a batch: as soon as udev reports the
+  * device of such a joystick, the joystick is opened again.
+  */
+
+#define DEFAULT_INTERVAL 100
+/* Large enough for the udev events of a hub full of devices */
+#define RCVBUF_SIZE (1 << 20)
+
+enum {
+	JOY_MANAGER_ADD = 1,
+	JOY_MANAGER_REMOVE,
+	/* removed, then added again */
+	JOY_MANAGER_READD,
+};
+
+typedef struct _JoyManagerChange JoyManagerChange;
+
+/* The net result of the udev events for one device node in this batch */
+struct _JoyManagerChange {
+	gchar* devnode;
+	gchar* syspath;
+	gint action;
+	guint seq;
+};
+
+struct _JoyManagerPrivate {
+	struct udev* udev;
+	struct udev_monitor* mon;
+	guint watch;
+	guint timer;
+	guint interval;
+	guint seq;
+	/* devnode -> JoyStick, with a reference */
+	GHashTable* sticks;
+	/* devnode -> JoyManagerChange */
+	GHashTable* pending;
+};
+
+enum {
+	JOY_MANAGER_INTERVAL = 1,
+	JOY_MANAGER_PROP_COUNT,
+};
+
+static GParamSpec *props[JOY_MANAGER_PROP_COUNT] = { NULL, };
+
+static GObjectClass* parent_class = NULL;
+
+/**
+  * joy_manager_get_default:
+  *
+  * Get the #JoyManager of this process. It is created by the first call
+  * to this function, which enumerates the joysticks that are plugged in
+  * at that time (see joy_stick_enumerate()).
+  *
+  * Returns: (transfer none): the #JoyManager.
+  */
+JoyManager* joy_manager_get_default(void) {
+	static JoyManager* manager = NULL;
+
+	if(g_once_init_enter(&manager)) {
+		g_once_init_leave(&manager, g_object_new(JOY_TYPE_MANAGER, NULL));
+	}
+	return manager;
+}
+
+static gint compare_devnode(gconstpointer a, gconstpointer b) {
+	return strcmp(joy_stick_get_devnode(JOY_STICK((gpointer)a)), joy_stick_get_devnode(JOY_STICK((gpointer)b)));
+}
+
+/**
+  * joy_manager_get_devices:
+  * @self: a #JoyManager
+  *
+  * Get the joysticks that are plugged in, sorted by device node.
+  *
+  * Returns: (element-type Joy.Stick) (transfer container): a #GList of
+  * #JoyStick objects, owned by the #JoyManager; free the list with
+  * g_list_free(), and take a reference to the joysticks you want to keep.
+  */
+GList* joy_manager_get_devices(JoyManager* self) {
+	g_return_val_if_fail(JOY_IS_MANAGER(self), NULL);
+	return g_list_sort(g_hash_table_get_values(self->priv->sticks), compare_devnode);
+}
+
+/**
+  * joy_manager_lookup:
+  * @self: a #JoyManager
+  * @devnode: a device node
+  *
+  * Find a joystick that is plugged in by its device node.
+  *
+  * Returns: (transfer none) (nullable): the #JoyStick, or %NULL if there
+  * is no such joystick.
+  */
+JoyStick* joy_manager_lookup(JoyManager* self, const gchar* devnode) {
+	g_return_val_if_fail(JOY_IS_MANAGER(self), NULL);
+	return g_hash_table_lookup(self->priv->sticks, devnode);
+}
+
+static void joy_manager_change_free(gpointer data) {
+	JoyManagerChange* change = data;
+
+	g_free(change->devnode);
+	g_free(change->syspath);
+	g_free(change);
+}
+
+static gint compare_seq(gconstpointer a, gconstpointer b) {
+	const JoyManagerChange* ca = a;
+	const JoyManagerChange* cb = b;
+
+	return ca->seq < cb->seq ? -1 : ca->seq > cb->seq;
+}
+
+static void joy_manager_remove(JoyManager* self, const gchar* devnode) {
+	JoyStick* stick = g_hash_table_lookup(self->priv->sticks, devnode);
+
+	if(!stick) {
+		return;
+	}
+	g_object_ref(stick);
+	g_hash_table_remove(self->priv->sticks, devnode);
+	g_signal_emit(self, JOY_MANAGER_GET_CLASS(self)->device_removed, 0, stick);
+	g_object_unref(stick);
+}
+
+static void joy_manager_add(JoyManager* self, JoyManagerChange* change) {
+	struct udev_device* dev;
+	gboolean preferred;
+	JoyStick* stick;
+
+	if(g_hash_table_contains(self->priv->sticks, change->devnode)) {
+		return;
+	}
+	/* Now that the batch is complete, all nodes of the joystick
+	 * exist, so this is a better time to choose between them than
+	 * when the event arrived */
+	dev = udev_device_new_from_syspath(self->priv->udev, change->syspath);
+	if(!dev) {
+		return;
+	}
+	preferred = _joy_stick_is_preferred_node(dev);
+	udev_device_unref(dev);
+	if(!preferred) {
+		return;
+	}
+	stick = joy_stick_open(change->devnode);
+	g_hash_table_insert(self->priv->sticks, g_strdup(change->devnode), stick);
+	g_signal_emit(self, JOY_MANAGER_GET_CLASS(self)->device_added, 0, stick);
+}
+
+/* Act on the net result of the udev events of a batch, in the order in
+ * which the devices first appeared in it */
+static gboolean joy_manager_flush(gpointer user_data) {
+	JoyManager* self = JOY_MANAGER(user_data);
+	GHashTable* pending = self->priv->pending;
+	GList* changes;
+
+	self->priv->timer = 0;
+	self->priv->pending = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, joy_manager_change_free);
+	changes = g_list_sort(g_hash_table_get_values(pending), compare_seq);
+	for(GList* l = changes; l; l = l->next) {
+		JoyManagerChange* change = l->data;
+
+		if(change->action != JOY_MANAGER_ADD) {
+			joy_manager_remove(self, change->devnode);
+		}
+		if(change->action != JOY_MANAGER_REMOVE) {
+			joy_manager_add(self, change);
+		}
+	}
+	g_list_free(changes);
+	g_hash_table_destroy(pending);
+	return FALSE;
+}
+
+/* A #JoyStick:persistent joystick whose device is plugged in again is
+ * rebound right away, rather than after the batch, since a reconnect is
+ * all about getting input back quickly. Returns TRUE if the manager
+ * already knew the joystick, in which case nothing changed for anyone
+ * watching it; otherwise, the device is handled like any new device, and
+ * the batch reports the same #JoyStick as added again. */
+static gboolean joy_manager_reconnect(JoyManager* self, struct udev_device* dev, const char* devnode) {
+	gchar* identity = _joy_device_identity(dev);
+	JoyStick* stick = identity ? _joy_stick_lookup_lost(identity) : NULL;
+	guint64 since = udev_device_get_usec_since_initialized(dev);
+	gboolean known = FALSE;
+	gchar* old;
+
+	g_free(identity);
+	if(!stick) {
+		return FALSE;
+	}
+	g_object_ref(stick);
+	old = g_strdup(joy_stick_get_devnode(stick));
+	if(_joy_stick_rebind(stick, devnode, g_get_monotonic_time() - since)) {
+		JoyManagerChange* change = g_hash_table_lookup(self->priv->pending, old);
+
+		if(change && change->action == JOY_MANAGER_REMOVE) {
+			g_hash_table_remove(self->priv->pending, old);
+		}
+		if(g_hash_table_remove(self->priv->sticks, old)) {
+			g_hash_table_insert(self->priv->sticks, g_strdup(devnode), g_object_ref(stick));
+			known = TRUE;
+		}
+	}
+	g_free(old);
+	g_object_unref(stick);
+	return known;
+}
+
+/* Fold a udev event into the pending changes */
+static void joy_manager_queue(JoyManager* self, struct udev_device* dev) {
+	const char* devnode = udev_device_get_devnode(dev);
+	const char* act = udev_device_get_action(dev);
+	const char* name = udev_device_get_sysname(dev);
+	JoyManagerChange* change;
+
+	if(!devnode || !act || !name) {
+		return;
+	}
+	if(!g_str_has_prefix(name, "event") && !g_str_has_prefix(name, "js")) {
+		return;
+	}
+	change = g_hash_table_lookup(self->priv->pending, devnode);
+	if(!strcmp(act, "add")) {
+		if(joy_manager_reconnect(self, dev, devnode)) {
+			return;
+		}
+		change = g_hash_table_lookup(self->priv->pending, devnode);
+		if(change) {
+			change->action = change->action == JOY_MANAGER_REMOVE ? JOY_MANAGER_READD : change->action;
+			g_free(change->syspath);
+			change->syspath = g_strdup(udev_device_get_syspath(dev));
+			return;
+		}
+		change = g_new0(JoyManagerChange, 1);
+		change->devnode = g_strdup(devnode);
+		change->syspath = g_strdup(udev_device_get_syspath(dev));
+		change->action = JOY_MANAGER_ADD;
+		change->seq = self->priv->seq++;
+		g_hash_table_insert(self->priv->pending, change->devnode, change);
+	} else if(!strcmp(act, "remove")) {
+		if(change) {
+			if(change->action == JOY_MANAGER_ADD) {
+				/* Came and went within this batch */
+				g_hash_table_remove(self->priv->pending, devnode);
+			} else {
+				change->action = JOY_MANAGER_REMOVE;
+			}
+			return;
+		}
+		if(!g_hash_table_contains(self->priv->sticks, devnode)) {
+			return;
+		}
+		change = g_new0(JoyManagerChange, 1);
+		change->devnode = g_strdup(devnode);
+		change->action = JOY_MANAGER_REMOVE;
+		change->seq = self->priv->seq++;
+		g_hash_table_insert(self->priv->pending, change->devnode, change);
+	}
+}
+
+static gboolean joy_manager_receive(gint fd G_GNUC_UNUSED, GIOCondition cond G_GNUC_UNUSED, gpointer user_data) {
+	JoyManager* self = JOY_MANAGER(user_data);
+	struct udev_device* dev;
+
+	/* The monitor does not block; take everything there is */
+	while((dev = udev_monitor_receive_device(self->priv->mon))) {
+		joy_manager_queue(self, dev);
+		udev_device_unref(dev);
+	}
+	if(g_hash_table_size(self->priv->pending) > 0 && !self->priv->timer) {
+		self->priv->timer = g_timeout_add(self->priv->interval, joy_manager_flush, self);
+	}
+	return TRUE;
+}
+
+static void instance_init(GTypeInstance* instance, gpointer g_class G_GNUC_UNUSED) {
+	JoyManager *self = JOY_MANAGER(instance);
+	GList* sticks;
+
+	self->priv = g_new0(JoyManagerPrivate, 1);
+	self->priv->interval = DEFAULT_INTERVAL;
+	self->priv->sticks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+	self->priv->pending = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, joy_manager_change_free);
+	self->priv->udev = udev_new();
+	if(self->priv->udev) {
+		/* Listen before enumerating, so that nothing falls in
+		 * between */
+		self->priv->mon = udev_monitor_new_from_netlink(self->priv->udev, "udev");
+	}
+	if(self->priv->mon) {
+		udev_monitor_filter_add_match_subsystem_devtype(self->priv->mon, "input", NULL);
+		udev_monitor_set_receive_buffer_size(self->priv->mon, RCVBUF_SIZE);
+		udev_monitor_enable_receiving(self->priv->mon);
+		self->priv->watch = g_unix_fd_add(udev_monitor_get_fd(self->priv->mon), G_IO_IN, joy_manager_receive, self);
+	}
+	sticks = joy_stick_enumerate();
+	for(GList* l = sticks; l; l = l->next) {
+		JoyStick* stick = l->data;
+
+		g_hash_table_insert(self->priv->sticks, g_strdup(joy_stick_get_devnode(stick)), stick);
+	}
+	g_list_free(sticks);
+}
+
+static void get_property(GObject* object, guint property_id, GValue *value, GParamSpec *pspec) {
+	JoyManager *self = JOY_MANAGER(object);
+
+	switch(property_id) {
+	case JOY_MANAGER_INTERVAL:
+		g_value_set_uint(value, self->priv->interval);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+static void set_property(GObject* object, guint property_id, const GValue *value, GParamSpec *pspec) {
+	JoyManager *self = JOY_MANAGER(object);
+
+	switch(property_id) {
+	case JOY_MANAGER_INTERVAL:
+		self->priv->interval = g_value_get_uint(value);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+static void finalize(GObject* object) {
+	JoyManager* self = JOY_MANAGER(object);
+
+	if(self->priv->timer) {
+		g_source_remove(self->priv->timer);
+	}
+	if(self->priv->watch) {
+		g_source_remove(self->priv->watch);
+	}
+	if(self->priv->mon) {
+		udev_monitor_unref(self->priv->mon);
+	}
+	if(self->priv->udev) {
+		udev_unref(self->priv->udev);
+	}
+	g_hash_table_destroy(self->priv->pending);
+	g_hash_table_destroy(self->priv->sticks);
+	g_free(self->priv);
+	parent_class->finalize(object);
+}
+
+static void class_init(gpointer g_class, gpointer g_class_data G_GNUC_UNUSED) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(g_class);
+	JoyManagerClass *klass = JOY_MANAGER_CLASS(g_class);
+
+	parent_class = g_type_class_peek_parent(g_class);
+	gobject_class->get_property = get_property;
+	gobject_class->set_property = set_property;
+	gobject_class->finalize = finalize;
+/**
+ * JoyManager:batch-interval:
+ *
+ * The time, in milliseconds, for which udev events are collected after
+ * the first one arrives, before the #JoyManager acts on them. Longer
+ * intervals absorb more of a storm of events, at the cost of reporting
+ * new devices later.
+ */
+	props[JOY_MANAGER_INTERVAL] =
+	  g_param_spec_uint("batch-interval",
+				    "Batch interval",
+				    "The time for which udev events are collected",
+				    0,
+				    G_MAXUINT,
+				    DEFAULT_INTERVAL,
+				    G_PARAM_READWRITE);
+	g_object_class_install_properties(gobject_class, JOY_MANAGER_PROP_COUNT, props);
+/**
+  * JoyManager::device-added:
+  * @object: the object which received the signal.
+  * @stick: the #JoyStick of the new device, already opened
+  *
+  * Emitted when a joystick was plugged in. The #JoyManager holds a
+  * reference to @stick until the joystick is unplugged.
+  */
+	klass->device_added =
+	  g_signal_new("device-added",
+				G_TYPE_FROM_CLASS(g_class),
+				G_SIGNAL_RUN_LAST,
+				0,
+				NULL,
+				NULL,
+				g_cclosure_marshal_VOID__OBJECT,
+				G_TYPE_NONE,
+				1,
+				JOY_TYPE_STICK);
+/**
+  * JoyManager::device-removed:
+  * @object: the object which received the signal.
+  * @stick: the #JoyStick of the device that was unplugged
+  *
+  * Emitted when a joystick was unplugged. If it is plugged in again, it
+  * is reported by #JoyManager::device-added, usually as a new #JoyStick;
+  * a #JoyStick:persistent joystick is reconnected instead, and reported
+  * as the same #JoyStick. If it is plugged in again before the end of the
+  * batch, neither signal is emitted.
+  */
+	klass->device_removed =
+	  g_signal_new("device-removed",
+				G_TYPE_FROM_CLASS(g_class),
+				G_SIGNAL_RUN_LAST,
+				0,
+				NULL,
+				NULL,
+				g_cclosure_marshal_VOID__OBJECT,
+				G_TYPE_NONE,
+				1,
+				JOY_TYPE_STICK);
+}
+
+GType joy_manager_get_type(void) {
+	static GType type = 0;
+	if(!type) {
+		static const GTypeInfo info = {
+			sizeof(JoyManagerClass),
+			NULL,	/* base_init */
+			NULL,	/* base_finalize */
+			class_init,	/* class_init */
+			NULL,	/* class_finalize */
+			NULL,	/* class_data */
+			sizeof(JoyManager),
+			0,	/* n_preallocs */
+			instance_init,
+		};
+		type = g_type_register_static(G_TYPE_OBJECT,
+					      "JoyManager",
+					      &info, 0);
+	}
+
+	return type;
+}
@@ -0,0 +1,78 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef LIBJOY_MANAGER_H
+#define LIBJOY_MANAGER_H
+
+#include <joy/joystick.h>
+
+G_BEGIN_DECLS
+
+#define JOY_TYPE_MANAGER		(joy_manager_get_type())
+#define JOY_MANAGER(obj)		(G_TYPE_CHECK_INSTANCE_CAST((obj), JOY_TYPE_MANAGER, JoyManager))
+#define JOY_MANAGER_CLASS(vtable)	(G_TYPE_CHECK_CLASS_CAST((vtable), JOY_TYPE_MANAGER, JoyManagerClass))
+#define JOY_IS_MANAGER(obj)		(G_TYPE_CHECK_INSTANCE_TYPE((obj), JOY_TYPE_MANAGER))
+#define JOY_IS_MANAGER_CLASS(vtable)	(G_TYPE_CHECK_CLASS_TYPE((vtable), JOY_TYPE_MANAGER))
+#define JOY_MANAGER_GET_CLASS(inst)	(G_TYPE_INSTANCE_GET_CLASS((inst), JOY_TYPE_MANAGER, JoyManagerClass))
+
+typedef struct _JoyManager JoyManager;
+typedef struct _JoyManagerClass JoyManagerClass;
+typedef struct _JoyManagerPrivate JoyManagerPrivate;
+
+/**
+  * JoyManager:
+  *
+  * Opaque object keeping track of the joysticks on the system
+  */
+struct _JoyManager {
+	/*< private >*/
+	GObject parent;
+	JoyManagerPrivate *priv;
+};
+
+/**
+  * JoyManagerClass:
+  * @device_added: signal emitted when a joystick was plugged in
+  * @device_removed: signal emitted when a joystick was unplugged
+  *
+  * The signals are only visible so that subclasses (if any) can use
+  * them.
+  */
+struct _JoyManagerClass {
+	/*< private >*/
+	GObjectClass parent;
+
+	/* signals */
+	/*< public >*/
+	guint device_added;
+	guint device_removed;
+};
+
+/* constructors & class functions */
+JoyManager* joy_manager_get_default(void);
+/* instance functions */
+GList* joy_manager_get_devices(JoyManager* self);
+JoyStick* joy_manager_lookup(JoyManager* self, const gchar* devnode);
+
+/* type handling functions */
+GType joy_manager_get_type(void) G_GNUC_PURE;
+
+G_END_DECLS
+
+#endif // LIBJOY_MANAGER_H
@@ -19,9 +19,7 @@
  */
 #include <string.h>
 #include <joy/joymodel.h>
-#include <libudev.h>
-
-#include <glib-unix.h>
+#include <joy/joymanager.h>
 
 /**
  * SECTION:joymodel
@@ -31,16 +29,49 @@
  * @include: joy/joymodel.h
  */
 
-typedef struct _JoyModelSource JoyModelSource;
+typedef struct _JoyModelRow JoyModelRow;
+
+/* Everything we know about a row; the iterators of a GtkListStore stay
+ * valid as long as their row exists */
+struct _JoyModelRow {
+	GtkTreeIter iter;
+	JoyModel* model;
+	JoyStick* stick;
+	/* the key of the row in the rows table */
+	gchar* devnode;
+	gulong report;
+	gulong rename;
+	gint16 xaxis;
+	gint16 yaxis;
+	/* the live values as of the last report, and as shown */
+	guint64 buttons;
+	gint x;
+	gint y;
+	guint64 shown_buttons;
+	gint shown_x;
+	gint shown_y;
+};
 
 struct _JoyModelPrivate {
-	GList* objs;
-	GList* iters;
-	struct udev_monitor* mon;
-	guint watch;
+	/* devnode -> JoyModelRow */
+	GHashTable* rows;
+	/* the rows whose live values changed since the last update */
+	GHashTable* dirty;
+	JoyManager* manager;
+	gboolean live;
+	GdkFrameClock* clock;
+	gulong update;
+	guint idle;
+};
+
+enum {
+	JOY_MODEL_LIVE = 1,
+	JOY_MODEL_PROP_COUNT,
 };
 
-struct udev* udev;
+static GParamSpec *props[JOY_MODEL_PROP_COUNT] = { NULL, };
+
+static GObjectClass* parent_class = NULL;
 
 /**
  * joy_model_new: (constructor)
@@ -53,77 +84,229 @@ struct udev* udev;
  * Returns: a #JoyModel, or NULL in case of error
  */
 GtkTreeModel* joy_model_new() {
-	JoyModel* mod;
-	GtkListStore* l;
+	return GTK_TREE_MODEL(g_object_new(JOY_TYPE_MODEL, NULL));
+}
 
-	mod = g_object_new(JOY_TYPE_MODEL, NULL);
-	l = GTK_LIST_STORE(mod);
+/**
+ * joy_model_get_iter_for_stick:
+ * @self: a #JoyModel
+ * @stick: a #JoyStick
+ * @iter: (out): the #GtkTreeIter to set
+ *
+ * Find the row of a joystick, without walking the model.
+ *
+ * Returns: %TRUE if @stick is in the model, with @iter set to its row.
+ */
+gboolean joy_model_get_iter_for_stick(JoyModel* self, JoyStick* stick, GtkTreeIter* iter) {
+	JoyModelRow* row;
 
-	if(!mod->priv->objs) {
-		return GTK_TREE_MODEL(l);
+	g_return_val_if_fail(JOY_IS_MODEL(self), FALSE);
+	g_return_val_if_fail(JOY_IS_STICK(stick), FALSE);
+	row = g_hash_table_lookup(self->priv->rows, joy_stick_get_devnode(stick));
+	if(!row) {
+		return FALSE;
 	}
+	*iter = row->iter;
+	return TRUE;
+}
 
-	GList* obj = mod->priv->objs;
+/* Show the live values of all rows that changed, with one row-changed
+ * per row */
+static void flush_rows(JoyModel* self) {
+	GHashTableIter it;
+	gpointer key;
 
-	while(obj != NULL) {
-		JoyStick* stick = JOY_STICK(obj->data);
-		GtkTreeIter* iter = g_new0(GtkTreeIter, 1);
-		mod->priv->iters = g_list_append(mod->priv->iters, iter);
+	g_hash_table_iter_init(&it, self->priv->dirty);
+	while(g_hash_table_iter_next(&it, &key, NULL)) {
+		JoyModelRow* row = key;
 
-		gtk_list_store_append(l, iter);
-		gtk_list_store_set(l, iter,
-				   JOY_COLUMN_DEV, joy_stick_get_devnode(stick),
-				   JOY_COLUMN_NAME, joy_stick_describe(stick),
-				   JOY_COLUMN_AXES, joy_stick_get_axis_count(stick),
-				   JOY_COLUMN_BUTTONS, joy_stick_get_button_count(stick),
-				   JOY_COLUMN_OBJECT, stick,
+		if(row->buttons == row->shown_buttons && row->x == row->shown_x && row->y == row->shown_y) {
+			continue;
+		}
+		row->shown_buttons = row->buttons;
+		row->shown_x = row->x;
+		row->shown_y = row->y;
+		gtk_list_store_set(GTK_LIST_STORE(self), &row->iter,
+				   JOY_COLUMN_BUTTON_MASK, row->buttons,
+				   JOY_COLUMN_X, row->x,
+				   JOY_COLUMN_Y, row->y,
 				   -1);
-		obj = obj->next;
 	}
+	g_hash_table_remove_all(self->priv->dirty);
+}
 
-	return GTK_TREE_MODEL(l);
+static void frame_update(GdkFrameClock* clock G_GNUC_UNUSED, gpointer user_data) {
+	flush_rows(JOY_MODEL(user_data));
 }
 
-static gboolean handle_udev_event(gint fd, GIOCondition cond, gpointer user_data) {
+static gboolean flush_idle(gpointer user_data) {
 	JoyModel* self = JOY_MODEL(user_data);
-	if(cond & G_IO_IN) {
-		struct udev_device *dev = udev_monitor_receive_device(self->priv->mon);
-		if(!dev) return TRUE;
-		const char* name = udev_device_get_sysname(dev);
-		if(name[0] != 'j' || name[1] != 's') return TRUE;
-		GList* obj = self->priv->objs;
-		GList* it = self->priv->iters;
-		const char* act = udev_device_get_action(dev);
-		if(!strcmp(act, "remove")) {
-			while(strcmp(joy_stick_get_devnode(JOY_STICK(obj->data)), udev_device_get_devnode(dev))) {
-				obj = obj->next;
-				it = it->next;
-			}
-			gtk_list_store_remove(GTK_LIST_STORE(self), it->data);
-			self->priv->objs = g_list_remove_link(self->priv->objs, obj);
-			self->priv->iters = g_list_remove_link(self->priv->iters, it);
-			g_object_unref(G_OBJECT(obj->data));
-			g_free(it->data);
-			obj = g_list_delete_link(obj, obj);
-			it = g_list_delete_link(it, it);
+
+	self->priv->idle = 0;
+	flush_rows(self);
+	return FALSE;
+}
+
+static void report(JoyStick* stick G_GNUC_UNUSED, JoyStickReport* rep, gpointer user_data) {
+	JoyModelRow* row = user_data;
+	JoyModel* self = row->model;
+
+	row->buttons = rep->buttons[0];
+	if(row->xaxis >= 0 && row->xaxis < rep->n_axes) {
+		row->x = rep->axes[row->xaxis];
+	}
+	if(row->yaxis >= 0 && row->yaxis < rep->n_axes) {
+		row->y = rep->axes[row->yaxis];
+	}
+	if(g_hash_table_size(self->priv->dirty) == 0) {
+		if(self->priv->clock) {
+			gdk_frame_clock_request_phase(self->priv->clock, GDK_FRAME_CLOCK_PHASE_UPDATE);
+		} else if(!self->priv->idle) {
+			/* Without a frame clock, still at most once per
+			 * iteration of the main loop, and before GTK redraws */
+			self->priv->idle = g_idle_add_full(GDK_PRIORITY_REDRAW - 10, flush_idle, self, NULL);
 		}
-		if(!strcmp(act, "add")) {
-			JoyStick* stick = joy_stick_open(udev_device_get_devnode(dev));
-			GtkTreeIter* iter = g_new0(GtkTreeIter, 1);
-			self->priv->iters = g_list_append(self->priv->iters, iter);
-			self->priv->objs = g_list_append(self->priv->objs, stick);
-
-			gtk_list_store_append(GTK_LIST_STORE(self), iter);
-			gtk_list_store_set(GTK_LIST_STORE(self), iter,
-							JOY_COLUMN_DEV, joy_stick_get_devnode(stick),
-							JOY_COLUMN_NAME, joy_stick_describe(stick),
-							JOY_COLUMN_AXES, joy_stick_get_axis_count(stick),
-							JOY_COLUMN_BUTTONS, joy_stick_get_button_count(stick),
-							JOY_COLUMN_OBJECT, stick,
-							-1);
+	}
+	g_hash_table_add(self->priv->dirty, row);
+}
+
+static void watch_row(JoyModelRow* row, gboolean live) {
+	if(live && !row->report) {
+		row->report = g_signal_connect(row->stick, "report", G_CALLBACK(report), row);
+	} else if(!live && row->report) {
+		g_signal_handler_disconnect(row->stick, row->report);
+		row->report = 0;
+		g_hash_table_remove(row->model->priv->dirty, row);
+	}
+}
+
+/* A persistent joystick came back on another device node */
+static void devnode_changed(GObject* stick G_GNUC_UNUSED, GParamSpec* pspec G_GNUC_UNUSED, gpointer user_data) {
+	JoyModelRow* row = user_data;
+	JoyModel* self = row->model;
+	const gchar* devnode = joy_stick_get_devnode(row->stick);
+	JoyModelRow* other;
+
+	if(!devnode || !strcmp(devnode, row->devnode)) {
+		return;
+	}
+	/* A row for a joystick that was on the new node is stale */
+	other = g_hash_table_lookup(self->priv->rows, devnode);
+	if(other) {
+		gtk_list_store_remove(GTK_LIST_STORE(self), &other->iter);
+		g_hash_table_remove(self->priv->rows, devnode);
+	}
+	/* The key is row->devnode, so it is freed here rather than by
+	 * the table */
+	g_hash_table_steal(self->priv->rows, row->devnode);
+	g_free(row->devnode);
+	row->devnode = g_strdup(devnode);
+	g_hash_table_insert(self->priv->rows, row->devnode, row);
+	gtk_list_store_set(GTK_LIST_STORE(self), &row->iter, JOY_COLUMN_DEV, devnode, -1);
+}
+
+static void free_row(gpointer data) {
+	JoyModelRow* row = data;
+
+	watch_row(row, FALSE);
+	g_signal_handler_disconnect(row->stick, row->rename);
+	g_object_unref(row->stick);
+	g_free(row);
+}
+
+static void add_row(JoyModel* self, JoyStick* stick) {
+	JoyModelRow* row;
+	guint64 buttons = 0;
+	gint32 axes[JOY_STICK_MAX_AXES] = { 0, };
+
+	if(g_hash_table_contains(self->priv->rows, joy_stick_get_devnode(stick))) {
+		return;
+	}
+	row = g_new0(JoyModelRow, 1);
+	row->model = self;
+	row->stick = g_object_ref(stick);
+	row->devnode = g_strdup(joy_stick_get_devnode(stick));
+	row->xaxis = joy_stick_get_typed_axis(stick, JOY_AXIS_X);
+	row->yaxis = joy_stick_get_typed_axis(stick, JOY_AXIS_Y);
+	joy_stick_get_button_mask(stick, &buttons, 1);
+	joy_stick_get_axes(stick, axes, JOY_STICK_MAX_AXES);
+	row->buttons = row->shown_buttons = buttons;
+	row->x = row->shown_x = row->xaxis >= 0 ? axes[row->xaxis] : 0;
+	row->y = row->shown_y = row->yaxis >= 0 ? axes[row->yaxis] : 0;
+	/* One row-inserted, rather than a row-inserted for an empty row
+	 * and a row-changed to fill it */
+	gtk_list_store_insert_with_values(GTK_LIST_STORE(self), &row->iter, -1,
+					JOY_COLUMN_DEV, joy_stick_get_devnode(stick),
+					JOY_COLUMN_NAME, joy_stick_describe(stick),
+					JOY_COLUMN_AXES, joy_stick_get_axis_count(stick),
+					JOY_COLUMN_BUTTONS, joy_stick_get_button_count(stick),
+					JOY_COLUMN_OBJECT, stick,
+					JOY_COLUMN_BUTTON_MASK, row->buttons,
+					JOY_COLUMN_X, row->x,
+					JOY_COLUMN_Y, row->y,
+					-1);
+	g_hash_table_insert(self->priv->rows, row->devnode, row);
+	row->rename = g_signal_connect(stick, "notify::devnode", G_CALLBACK(devnode_changed), row);
+	watch_row(row, self->priv->live);
+}
+
+static void device_removed(JoyManager* manager G_GNUC_UNUSED, JoyStick* stick, gpointer user_data) {
+	JoyModel* self = JOY_MODEL(user_data);
+	JoyModelRow* row = g_hash_table_lookup(self->priv->rows, joy_stick_get_devnode(stick));
+
+	/* not one of ours */
+	if(!row) return;
+	gtk_list_store_remove(GTK_LIST_STORE(self), &row->iter);
+	g_hash_table_remove(self->priv->rows, joy_stick_get_devnode(stick));
+}
+
+static void device_added(JoyManager* manager G_GNUC_UNUSED, JoyStick* stick, gpointer user_data) {
+	add_row(JOY_MODEL(user_data), stick);
+}
+
+/**
+ * joy_model_set_live:
+ * @self: a #JoyModel
+ * @live: whether to keep the live columns up to date
+ *
+ * Set the #JoyModel:live property.
+ */
+void joy_model_set_live(JoyModel* self, gboolean live) {
+	g_return_if_fail(JOY_IS_MODEL(self));
+	g_object_set(G_OBJECT(self), "live", live, NULL);
+}
+
+/**
+ * joy_model_set_frame_clock:
+ * @self: a #JoyModel
+ * @clock: (nullable): the #GdkFrameClock of the widget that shows the
+ * model, or %NULL
+ *
+ * Update the live columns (see #JoyModel:live) in the update phase of
+ * @clock: however many reports a joystick makes, its row then changes
+ * at most once per frame. Use gtk_widget_get_frame_clock() on the
+ * widget that shows the model, once it is realized.
+ *
+ * Without a frame clock, the live columns are updated at most once per
+ * iteration of the main loop.
+ */
+void joy_model_set_frame_clock(JoyModel* self, GdkFrameClock* clock) {
+	g_return_if_fail(JOY_IS_MODEL(self));
+	if(self->priv->clock == clock) {
+		return;
+	}
+	if(self->priv->clock) {
+		g_signal_handler_disconnect(self->priv->clock, self->priv->update);
+		g_clear_object(&self->priv->clock);
+		self->priv->update = 0;
+	}
+	if(clock) {
+		self->priv->clock = g_object_ref(clock);
+		self->priv->update = g_signal_connect(clock, "update", G_CALLBACK(frame_update), self);
+		if(g_hash_table_size(self->priv->dirty) > 0) {
+			gdk_frame_clock_request_phase(clock, GDK_FRAME_CLOCK_PHASE_UPDATE);
 		}
 	}
-	return TRUE;
 }
 
 static void instance_init(GTypeInstance* instance, gpointer g_class) {
@@ -134,28 +317,97 @@ static void instance_init(GTypeInstance* instance, gpointer g_class) {
 		G_TYPE_UCHAR,
 		G_TYPE_UCHAR,
 		JOY_TYPE_STICK,
+		G_TYPE_UINT64,
+		G_TYPE_INT,
+		G_TYPE_INT,
 	};
+	GList* sticks;
 
 	gtk_list_store_set_column_types(GTK_LIST_STORE(self), JOY_COLUMN_COUNT, types);
 
 	self->priv = g_new0(JoyModelPrivate, 1);
-	self->priv->objs = joy_stick_enumerate(NULL);
-	self->priv->mon = udev_monitor_new_from_netlink(udev, "udev");
-	udev_monitor_filter_add_match_subsystem_devtype(self->priv->mon, "input", NULL);
-	udev_monitor_enable_receiving(self->priv->mon);
-	int fd = udev_monitor_get_fd(self->priv->mon);
-	self->priv->watch = g_unix_fd_add(fd, G_IO_IN | G_IO_HUP, handle_udev_event, self);
+	self->priv->rows = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_row);
+	self->priv->dirty = g_hash_table_new(NULL, NULL);
+	self->priv->manager = g_object_ref(joy_manager_get_default());
+	/* Fill the model before anyone can watch it, so that the initial
+	 * rows cost no more than filling a list */
+	sticks = joy_manager_get_devices(self->priv->manager);
+	for(GList* l = sticks; l; l = l->next) {
+		add_row(self, JOY_STICK(l->data));
+	}
+	g_list_free(sticks);
+	g_signal_connect(self->priv->manager, "device-added", G_CALLBACK(device_added), self);
+	g_signal_connect(self->priv->manager, "device-removed", G_CALLBACK(device_removed), self);
 }
 
-static void instance_finalize(GObject* self) {
-	udev_monitor_unref(JOY_MODEL(self)->priv->mon);
+static void get_property(GObject* object, guint property_id, GValue *value, GParamSpec *pspec) {
+	JoyModel *self = JOY_MODEL(object);
+
+	switch(property_id) {
+	case JOY_MODEL_LIVE:
+		g_value_set_boolean(value, self->priv->live);
+		break;
+	default:
+		g_assert_not_reached();
+	}
 }
 
-static void class_init(gpointer klass, gpointer data G_GNUC_UNUSED) {
-	udev = udev_new();
-	G_OBJECT_CLASS(klass)->finalize = instance_finalize;
+static void set_property(GObject* object, guint property_id, const GValue *value, GParamSpec *pspec) {
+	JoyModel *self = JOY_MODEL(object);
+	GHashTableIter it;
+	gpointer row;
+
+	switch(property_id) {
+	case JOY_MODEL_LIVE:
+		self->priv->live = g_value_get_boolean(value);
+		g_hash_table_iter_init(&it, self->priv->rows);
+		while(g_hash_table_iter_next(&it, NULL, &row)) {
+			watch_row(row, self->priv->live);
+		}
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+static void instance_finalize(GObject* object) {
+	JoyModel* self = JOY_MODEL(object);
+
+	g_signal_handlers_disconnect_by_data(self->priv->manager, self);
+	g_object_unref(self->priv->manager);
+	joy_model_set_frame_clock(self, NULL);
+	if(self->priv->idle) {
+		g_source_remove(self->priv->idle);
+	}
+	g_hash_table_destroy(self->priv->rows);
+	g_hash_table_destroy(self->priv->dirty);
+	g_free(self->priv);
+	parent_class->finalize(object);
 }
 
+static void class_init(gpointer klass, gpointer data G_GNUC_UNUSED) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+	parent_class = g_type_class_peek_parent(klass);
+	gobject_class->get_property = get_property;
+	gobject_class->set_property = set_property;
+	gobject_class->finalize = instance_finalize;
+/**
+ * JoyModel:live:
+ *
+ * Whether the #JOY_COLUMN_BUTTON_MASK, #JOY_COLUMN_X and #JOY_COLUMN_Y
+ * columns follow the state of the joysticks. Changes are collected, and
+ * shown at most once per frame (see joy_model_set_frame_clock()), so a
+ * view of the model does not redraw for every event.
+ */
+	props[JOY_MODEL_LIVE] =
+	  g_param_spec_boolean("live",
+				    "Live",
+				    "Whether the live columns follow the state of the joysticks",
+				    FALSE,
+				    G_PARAM_READWRITE);
+	g_object_class_install_properties(gobject_class, JOY_MODEL_PROP_COUNT, props);
+}
 GType joy_model_get_type(void) {
 	static GType type = 0;
 	if(!type) {
@@ -30,6 +30,12 @@
  * @JOY_COLUMN_AXES: the number of axes on the joystick
  * @JOY_COLUMN_BUTTONS: the number of buttons on the joystick
  * @JOY_COLUMN_OBJECT: the #JoyStick object
+ * @JOY_COLUMN_BUTTON_MASK: the state of the first 64 buttons, as a bitmask;
+ * only kept up to date if #JoyModel:live is %TRUE
+ * @JOY_COLUMN_X: the value of the X axis, or 0 if there is none; only kept
+ * up to date if #JoyModel:live is %TRUE
+ * @JOY_COLUMN_Y: the value of the Y axis, or 0 if there is none; only kept
+ * up to date if #JoyModel:live is %TRUE
  */
 typedef enum joy_model_columns {
 	JOY_COLUMN_DEV,
@@ -37,6 +43,9 @@ typedef enum joy_model_columns {
 	JOY_COLUMN_AXES,
 	JOY_COLUMN_BUTTONS,
 	JOY_COLUMN_OBJECT,
+	JOY_COLUMN_BUTTON_MASK,
+	JOY_COLUMN_X,
+	JOY_COLUMN_Y,
 	/*< private >*/
 	JOY_COLUMN_COUNT
 } JoyModelColumns;
@@ -74,6 +83,9 @@ struct _JoyModelClass {
 };
 
 GtkTreeModel* joy_model_new();
+gboolean joy_model_get_iter_for_stick(JoyModel* self, JoyStick* stick, GtkTreeIter* iter);
+void joy_model_set_live(JoyModel* self, gboolean live);
+void joy_model_set_frame_clock(JoyModel* self, GdkFrameClock* clock);
 
 GType joy_model_get_type(void) G_GNUC_CONST;
 
@@ -0,0 +1,894 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/input.h>
+
+#include <glib-unix.h>
+
+#include <joy/joyrecorder.h>
+#include "joy-private.h"
+
+/**
+  * SECTION:joyrecorder
+  * @short_description: record the events of a joystick, and play them back
+  * @see_also: #JoyStick, #JoyVirtual
+  * @stability: Unstable
+  * @include: joy/joyrecorder.h
+  *
+  * A #JoyRecorder writes everything a #JoyStick reads from its device to
+  * a file, along with the layout of the device. A #JoyPlayer turns such
+  * a file back into a joystick: like a #JoyVirtual, it has a device node
+  * that can be passed to joy_stick_open(), and the resulting #JoyStick
+  * issues the recorded events through the same code as it would for the
+  * real device, either at the pace at which they were recorded, or as
+  * fast as the #JoyStick can take them.
+  *
+  * A recording is made of a header with the layout of the device,
+  * followed by the events in the order in which they were read. Every so
+  * many events (the interval that was passed to joy_recorder_new()), the
+  * complete state of the device is stored as well, so that
+  * joy_player_seek() only has to look at one interval of events to
+  * reconstruct the state at any point. All of these have a fixed size,
+  * so the file is only ever appended to, and the position of every event
+  * can be computed; if the recording was cut short, everything up to the
+  * last complete event can still be played. Recordings are in the byte
+  * order of the machine that made them.
+  *
+  * The #JoyPlayer maps the file into memory rather than reading it,
+  * and hands the events to the #JoyStick in chunks, so playing back a
+  * recording does not take a system call per event.
+  */
+
+#define RECORDER_MAGIC "JOYREC\r\n"
+#define RECORDER_VERSION 1
+#define KEYFRAME_MAGIC "JOYK"
+#define DEFAULT_INTERVAL 4096
+/* The JoyStick takes whatever we write in one go */
+#define FILE_BUFSZ (1 << 16)
+
+#define REPLAY_PREFIX "replay:"
+
+/* The number of records that can be written to a pipe atomically */
+#define CHUNK (PIPE_BUF / sizeof(JoyRecord))
+
+typedef struct _JoyRecHeader JoyRecHeader;
+typedef struct _JoyRecKeyframe JoyRecKeyframe;
+
+/* The start of a recording. All sizes are multiples of the size of a
+ * JoyRecord, so that records in a mapped file are aligned. */
+struct _JoyRecHeader {
+	gchar magic[8];
+	guint32 version;
+	/* of this structure, so that later versions can extend it */
+	guint32 header_size;
+	/* the number of events between keyframes */
+	guint32 interval;
+	guint8 naxes;
+	guint8 nbuts;
+	guint16 pad;
+	/* when the recording was started, in g_get_monotonic_time() */
+	gint64 start;
+	gchar name[JOY_NAME_LEN];
+	guint8 axmap[JOY_STICK_MAX_AXES];
+	guint16 butmap[JOY_STICK_MAX_BUTTONS];
+	gint32 axmin[JOY_STICK_MAX_AXES];
+	gint32 axmax[JOY_STICK_MAX_AXES];
+};
+
+/* The state of the device before event number seq */
+struct _JoyRecKeyframe {
+	gchar magic[4];
+	guint32 pad;
+	gint64 time;
+	guint64 seq;
+	gint32 axes[JOY_STICK_MAX_AXES];
+	guint64 buttons[JOY_STICK_MAX_BUTTONS / 64];
+	guint64 pad2;
+};
+
+G_STATIC_ASSERT(sizeof(JoyRecHeader) % sizeof(JoyRecord) == 0);
+G_STATIC_ASSERT(sizeof(JoyRecKeyframe) % sizeof(JoyRecord) == 0);
+
+/* Apply one recorded event to a state */
+static void joy_record_apply(gint32* axes, guint64* buttons, const JoyRecord* rec) {
+	switch(rec->type) {
+	case JOY_EVENT_AXIS:
+		if(rec->number < JOY_STICK_MAX_AXES) {
+			axes[rec->number] = rec->value;
+		}
+		break;
+	case JOY_EVENT_BUTTON:
+		if(rec->value) {
+			buttons[rec->number / 64] |= G_GUINT64_CONSTANT(1) << (rec->number % 64);
+		} else {
+			buttons[rec->number / 64] &= ~(G_GUINT64_CONSTANT(1) << (rec->number % 64));
+		}
+		break;
+	}
+}
+
+/* JoyRecorder */
+
+struct _JoyRecorderPrivate {
+	JoyStick* stick;
+	FILE* file;
+	guint interval;
+	/* Only written by the thread that reads from the device */
+	guint64 count;
+	gint64 last;
+	int error;
+	gint32 axes[JOY_STICK_MAX_AXES];
+	guint64 buttons[JOY_STICK_MAX_BUTTONS / 64];
+};
+
+static GObjectClass* recorder_parent_class = NULL;
+
+static void joy_recorder_write(JoyRecorder* self, const void* data, gsize size) {
+	if(fwrite(data, size, 1, self->priv->file) != 1 && !self->priv->error) {
+		self->priv->error = errno ? errno : EIO;
+	}
+}
+
+/* The tap on the JoyStick; called on the thread that reads from the
+ * device, with the events as the backend produced them */
+static void joy_recorder_tap(gpointer data, const JoyEvent* evs, gsize count) {
+	JoyRecorder* self = data;
+
+	for(gsize i=0; i<count; i++) {
+		JoyRecord rec = { 0, };
+
+		if(evs[i].type == JOY_EVENT_NONE) {
+			continue;
+		}
+		if(self->priv->count % self->priv->interval == 0) {
+			JoyRecKeyframe kf = { KEYFRAME_MAGIC, };
+
+			kf.time = self->priv->last;
+			kf.seq = self->priv->count;
+			memcpy(kf.axes, self->priv->axes, sizeof(kf.axes));
+			memcpy(kf.buttons, self->priv->buttons, sizeof(kf.buttons));
+			joy_recorder_write(self, &kf, sizeof(kf));
+		}
+		rec.time = evs[i].time;
+		rec.value = evs[i].value;
+		rec.type = evs[i].type;
+		rec.number = evs[i].number;
+		rec.flags = evs[i].flags & JOY_EVENT_INIT;
+		joy_recorder_write(self, &rec, sizeof(rec));
+		joy_record_apply(self->priv->axes, self->priv->buttons, &rec);
+		self->priv->last = rec.time;
+		__atomic_store_n(&self->priv->count, self->priv->count + 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+  * joy_recorder_new: (constructor)
+  * @stick: the #JoyStick to record
+  * @path: the file to write the recording to; it is overwritten if it
+  * exists
+  * @interval: the number of events after which the complete state of the
+  * joystick is stored again, or 0 for the default. Smaller values make
+  * joy_player_seek() faster, and the recording larger.
+  * @err: return location for a #GError, or %NULL
+  *
+  * Start recording the events of @stick, from the next event that is
+  * read from its device until joy_recorder_stop() is called or the
+  * #JoyRecorder is finalized. The events are recorded as they are read,
+  * whether or not they are issued as signals, so the #JoyMode of @stick
+  * does not matter; only the events of a state dump that change nothing
+  * are left out. A #JoyStick can only be recorded by one #JoyRecorder
+  * at a time.
+  *
+  * Returns: a newly-allocated #JoyRecorder, or %NULL with @err set if the
+  * file could not be created, or @stick is already being recorded.
+  */
+JoyRecorder* joy_recorder_new(JoyStick* stick, const gchar* path, guint interval, GError** err) {
+	JoyRecorder* self;
+	JoyRecHeader* hdr;
+	FILE* file;
+
+	g_return_val_if_fail(JOY_IS_STICK(stick), NULL);
+	g_return_val_if_fail(path != NULL, NULL);
+
+	file = fopen(path, "wbe");
+	if(!file) {
+		int e = errno;
+		g_set_error(err, G_IO_ERROR, g_io_error_from_errno(e), "Could not create %s: %s", path, g_strerror(e));
+		return NULL;
+	}
+	setvbuf(file, NULL, _IOFBF, FILE_BUFSZ);
+
+	hdr = g_new0(JoyRecHeader, 1);
+	memcpy(hdr->magic, RECORDER_MAGIC, sizeof(hdr->magic));
+	hdr->version = RECORDER_VERSION;
+	hdr->header_size = sizeof(JoyRecHeader);
+	hdr->interval = interval ? interval : DEFAULT_INTERVAL;
+	hdr->naxes = joy_stick_get_axis_count(stick);
+	hdr->nbuts = joy_stick_get_button_count(stick);
+	hdr->start = g_get_monotonic_time();
+	g_strlcpy(hdr->name, joy_stick_describe(stick) ? joy_stick_describe(stick) : "", sizeof(hdr->name));
+	for(guint8 i=0; i<hdr->naxes; i++) {
+		gint min, max;
+
+		hdr->axmap[i] = joy_stick_get_axis_type(stick, i);
+		joy_stick_get_axis_range(stick, i, &min, &max);
+		hdr->axmin[i] = min;
+		hdr->axmax[i] = max;
+	}
+	for(guint8 i=0; i<hdr->nbuts; i++) {
+		hdr->butmap[i] = BTN_MISC + joy_stick_get_button_type(stick, i);
+	}
+
+	self = JOY_RECORDER(g_object_new(JOY_TYPE_RECORDER, NULL));
+	self->priv->file = file;
+	self->priv->interval = hdr->interval;
+	self->priv->last = hdr->start;
+	joy_recorder_write(self, hdr, sizeof(*hdr));
+	g_free(hdr);
+	if(self->priv->error) {
+		g_set_error(err, G_IO_ERROR, g_io_error_from_errno(self->priv->error), "Could not write to %s: %s", path, g_strerror(self->priv->error));
+		g_object_unref(self);
+		unlink(path);
+		return NULL;
+	}
+	/* The first keyframe starts from the state as the JoyStick knows it
+	 * when the tap is installed, so that no event falls in between */
+	if(!_joy_stick_set_tap(stick, joy_recorder_tap, self, self->priv->axes, self->priv->buttons)) {
+		g_set_error(err, G_IO_ERROR, G_IO_ERROR_BUSY, "%s is already being recorded", joy_stick_get_devnode(stick));
+		g_object_unref(self);
+		unlink(path);
+		return NULL;
+	}
+	self->priv->stick = g_object_ref(stick);
+
+	return self;
+}
+
+/**
+  * joy_recorder_stop:
+  * @self: a #JoyRecorder
+  * @err: return location for a #GError, or %NULL
+  *
+  * Stop recording, and close the file. Calling this function again has
+  * no effect.
+  *
+  * Returns: %FALSE, with @err set, if the recording could not be written
+  * completely.
+  */
+gboolean joy_recorder_stop(JoyRecorder* self, GError** err) {
+	g_return_val_if_fail(JOY_IS_RECORDER(self), FALSE);
+	if(!self->priv->file) {
+		return TRUE;
+	}
+	if(self->priv->stick) {
+		/* Waits for a tap that is in progress */
+		_joy_stick_set_tap(self->priv->stick, NULL, NULL, NULL, NULL);
+		g_object_unref(self->priv->stick);
+		self->priv->stick = NULL;
+	}
+	if(fclose(self->priv->file) != 0 && !self->priv->error) {
+		self->priv->error = errno;
+	}
+	self->priv->file = NULL;
+	if(self->priv->error) {
+		g_set_error(err, G_IO_ERROR, g_io_error_from_errno(self->priv->error), "Could not write recording: %s", g_strerror(self->priv->error));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+  * joy_recorder_get_event_count:
+  * @self: a #JoyRecorder
+  *
+  * Get the number of events that were recorded so far. Can be called
+  * from any thread.
+  *
+  * Returns: the number of events in the recording.
+  */
+guint64 joy_recorder_get_event_count(JoyRecorder* self) {
+	g_return_val_if_fail(JOY_IS_RECORDER(self), 0);
+	return __atomic_load_n(&self->priv->count, __ATOMIC_RELAXED);
+}
+
+static void recorder_instance_init(GTypeInstance* instance, gpointer g_class G_GNUC_UNUSED) {
+	JoyRecorder* self = JOY_RECORDER(instance);
+
+	self->priv = g_new0(JoyRecorderPrivate, 1);
+}
+
+static void recorder_finalize(GObject* object) {
+	JoyRecorder* self = JOY_RECORDER(object);
+
+	joy_recorder_stop(self, NULL);
+	g_free(self->priv);
+	recorder_parent_class->finalize(object);
+}
+
+static void recorder_class_init(gpointer g_class, gpointer g_class_data G_GNUC_UNUSED) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(g_class);
+
+	recorder_parent_class = g_type_class_peek_parent(g_class);
+	gobject_class->finalize = recorder_finalize;
+}
+
+GType joy_recorder_get_type(void) {
+	static GType type = 0;
+	if(!type) {
+		static const GTypeInfo info = {
+			sizeof(JoyRecorderClass),
+			NULL,	/* base_init */
+			NULL,	/* base_finalize */
+			recorder_class_init,	/* class_init */
+			NULL,	/* class_finalize */
+			NULL,	/* class_data */
+			sizeof(JoyRecorder),
+			0,	/* n_preallocs */
+			recorder_instance_init,
+		};
+		type = g_type_register_static(G_TYPE_OBJECT,
+					      "JoyRecorder",
+					      &info, 0);
+	}
+
+	return type;
+}
+
+/* JoyPlayer */
+
+typedef struct _JoyPlayerSource JoyPlayerSource;
+
+struct _JoyPlayerSource {
+	GSource source;
+	JoyPlayer* player;
+};
+
+struct _JoyPlayerPrivate {
+	guchar* map;
+	gsize size;
+	const JoyRecHeader* hdr;
+	/* the size of a keyframe and the events that follow it */
+	gsize groupsize;
+	guint64 nevents;
+	guint64 pos;
+	gchar* devnode;
+	int rfd;
+	int wfd;
+	gboolean realtime;
+	/* added to the time of a recorded event to get the time at which it
+	 * is due */
+	gint64 offset;
+	/* whether a JoyStick has opened us */
+	gboolean playing;
+	GSource* pump;
+	gpointer tag;
+};
+
+enum {
+	JOY_PLAYER_DEVNODE = 1,
+	JOY_PLAYER_REALTIME,
+	JOY_PLAYER_PROP_COUNT,
+};
+
+static GParamSpec *player_props[JOY_PLAYER_PROP_COUNT] = { NULL, };
+
+static GObjectClass* player_parent_class = NULL;
+
+/* All JoyPlayer objects by device node, so that the backend can find
+ * them; the table does not hold a reference */
+static GHashTable* players = NULL;
+G_LOCK_DEFINE_STATIC(players);
+static gint serial = 0;
+
+static const JoyRecKeyframe* joy_player_keyframe(JoyPlayer* self, guint64 group) {
+	gsize offset = self->priv->hdr->header_size + group * self->priv->groupsize;
+
+	if(offset + sizeof(JoyRecKeyframe) > self->priv->size) {
+		return NULL;
+	}
+	return (const JoyRecKeyframe*)(self->priv->map + offset);
+}
+
+static const JoyRecord* joy_player_event(JoyPlayer* self, guint64 event) {
+	guint interval = self->priv->hdr->interval;
+
+	return (const JoyRecord*)(self->priv->map + self->priv->hdr->header_size
+		+ (event / interval) * self->priv->groupsize
+		+ sizeof(JoyRecKeyframe)
+		+ (event % interval) * sizeof(JoyRecord));
+}
+
+/* Reconstruct the state of the device before event number pos: start at
+ * the last keyframe, and apply the events after it */
+static void joy_player_state(JoyPlayer* self, guint64 pos, gint32* axes, guint64* buttons) {
+	guint64 group = pos / self->priv->hdr->interval;
+	const JoyRecKeyframe* kf = joy_player_keyframe(self, group);
+
+	/* If the recording ends right before a keyframe, it was never
+	 * written */
+	if(!kf && group > 0) {
+		kf = joy_player_keyframe(self, --group);
+	}
+	if(!kf) {
+		memset(axes, 0, JOY_STICK_MAX_AXES * sizeof(gint32));
+		memset(buttons, 0, JOY_STICK_MAX_BUTTONS / 8);
+		return;
+	}
+	memcpy(axes, kf->axes, sizeof(kf->axes));
+	memcpy(buttons, kf->buttons, sizeof(kf->buttons));
+	for(guint64 i=group * self->priv->hdr->interval; i<pos; i++) {
+		joy_record_apply(axes, buttons, joy_player_event(self, i));
+	}
+}
+
+/* Play the event at the current position now, and the ones after it at
+ * the pace at which they were recorded */
+static void joy_player_restart(JoyPlayer* self) {
+	if(self->priv->pos < self->priv->nevents) {
+		self->priv->offset = g_get_monotonic_time() - joy_player_event(self, self->priv->pos)->time;
+	}
+	if(self->priv->playing) {
+		g_source_set_ready_time(self->priv->pump, 0);
+	}
+}
+
+static void joy_player_finish(JoyPlayer* self) {
+	g_source_remove_unix_fd(self->priv->pump, self->priv->tag);
+	self->priv->tag = NULL;
+	close(self->priv->wfd);
+	self->priv->wfd = -1;
+	self->priv->playing = FALSE;
+}
+
+/* Hand the events that are due to the JoyStick, as many at a time as
+ * the pipe takes atomically */
+static gboolean joy_player_pump(GSource* source, GSourceFunc callback G_GNUC_UNUSED, gpointer user_data G_GNUC_UNUSED) {
+	JoyPlayer* self = ((JoyPlayerSource*)source)->player;
+	guint interval = self->priv->hdr->interval;
+	gint64 now = g_get_monotonic_time();
+	JoyRecord buf[CHUNK];
+
+	g_source_set_ready_time(source, -1);
+	if(!self->priv->playing) {
+		return TRUE;
+	}
+	g_source_modify_unix_fd(source, self->priv->tag, 0);
+	while(self->priv->pos < self->priv->nevents) {
+		guint64 pos = self->priv->pos;
+		/* Events are contiguous up to the next keyframe */
+		gsize n = MIN(CHUNK, MIN(interval - pos % interval, self->priv->nevents - pos));
+		const JoyRecord* recs = joy_player_event(self, pos);
+		gsize due = n;
+		gsize done;
+
+		if(self->priv->realtime) {
+			for(due=0; due<n && recs[due].time + self->priv->offset <= now; due++);
+			if(due == 0) {
+				g_source_set_ready_time(source, recs[0].time + self->priv->offset);
+				return TRUE;
+			}
+		}
+		for(gsize i=0; i<due; i++) {
+			buf[i] = recs[i];
+			buf[i].time = self->priv->realtime ? recs[i].time + self->priv->offset : now;
+		}
+		done = _joy_record_write(self->priv->wfd, buf, due);
+		self->priv->pos += done;
+		if(done < due) {
+			/* The JoyStick has to catch up first */
+			g_source_modify_unix_fd(source, self->priv->tag, G_IO_OUT);
+			return TRUE;
+		}
+	}
+	/* Like unplugging the device */
+	joy_player_finish(self);
+	return TRUE;
+}
+
+static GSourceFuncs pump_funcs = {
+	NULL,	/* prepare */
+	NULL,	/* check */
+	joy_player_pump,
+	NULL,	/* finalize */
+};
+
+/**
+  * joy_player_new: (constructor)
+  * @path: the file with the recording, as written by a #JoyRecorder
+  * @err: return location for a #GError, or %NULL
+  *
+  * Prepare a recording for playback. Playback starts when a #JoyStick
+  * opens the device node returned by joy_player_get_devnode(), and is
+  * driven by the thread-default #GMainContext of the caller of this
+  * function, which must therefore be running. Once all events were
+  * played, the #JoyStick issues the #JoyStick::disconnected signal.
+  *
+  * A #JoyPlayer is not thread-safe: it must only be used from the thread
+  * that owns its #GMainContext, and that includes opening it with
+  * joy_stick_open(). The #JoyStick may issue its events on any thread.
+  *
+  * Returns: a newly-allocated #JoyPlayer, or %NULL with @err set if the
+  * file could not be read, or is not a recording.
+  */
+JoyPlayer* joy_player_new(const gchar* path, GError** err) {
+	JoyPlayer* self;
+	const JoyRecHeader* hdr;
+	struct stat st;
+	gsize body, rest;
+	void* map;
+	int fds[2];
+	int fd;
+
+	g_return_val_if_fail(path != NULL, NULL);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0 || fstat(fd, &st) < 0) {
+		int e = errno;
+		g_set_error(err, G_IO_ERROR, g_io_error_from_errno(e), "Could not open %s: %s", path, g_strerror(e));
+		if(fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	if((gsize)st.st_size < sizeof(JoyRecHeader)) {
+		g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s is not a joystick recording", path);
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		int e = errno;
+		g_set_error(err, G_IO_ERROR, g_io_error_from_errno(e), "Could not map %s: %s", path, g_strerror(e));
+		return NULL;
+	}
+	hdr = map;
+	if(memcmp(hdr->magic, RECORDER_MAGIC, sizeof(hdr->magic)) != 0
+			|| hdr->version != RECORDER_VERSION
+			|| hdr->header_size < sizeof(JoyRecHeader)
+			|| hdr->header_size % sizeof(JoyRecord) != 0
+			|| hdr->header_size > (gsize)st.st_size
+			|| hdr->interval == 0
+			|| hdr->naxes > JOY_STICK_MAX_AXES) {
+		g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s is not a joystick recording, or was made on a different kind of machine", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	if(_joy_record_pipe(fds) < 0) {
+		int e = errno;
+		g_set_error(err, G_IO_ERROR, g_io_error_from_errno(e), "Could not create pipe: %s", g_strerror(e));
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	self = JOY_PLAYER(g_object_new(JOY_TYPE_PLAYER, NULL));
+	self->priv->map = map;
+	self->priv->size = st.st_size;
+	self->priv->hdr = hdr;
+	self->priv->groupsize = sizeof(JoyRecKeyframe) + (gsize)hdr->interval * sizeof(JoyRecord);
+	/* Only count complete events */
+	body = self->priv->size - hdr->header_size;
+	rest = body % self->priv->groupsize;
+	self->priv->nevents = (guint64)(body / self->priv->groupsize) * hdr->interval;
+	if(rest > sizeof(JoyRecKeyframe)) {
+		self->priv->nevents += (rest - sizeof(JoyRecKeyframe)) / sizeof(JoyRecord);
+	}
+	self->priv->rfd = fds[0];
+	self->priv->wfd = fds[1];
+	self->priv->pump = g_source_new(&pump_funcs, sizeof(JoyPlayerSource));
+	((JoyPlayerSource*)self->priv->pump)->player = self;
+	self->priv->tag = g_source_add_unix_fd(self->priv->pump, self->priv->wfd, 0);
+	g_source_attach(self->priv->pump, g_main_context_get_thread_default());
+
+	return self;
+}
+
+/**
+  * joy_player_get_devnode:
+  * @self: a #JoyPlayer
+  *
+  * Get the name under which joy_stick_open() finds this recording. It
+  * does not exist in the file system.
+  *
+  * Returns: (transfer none): the device node of the recording.
+  */
+const gchar* joy_player_get_devnode(JoyPlayer* self) {
+	g_return_val_if_fail(JOY_IS_PLAYER(self), NULL);
+	return self->priv->devnode;
+}
+
+/**
+  * joy_player_get_event_count:
+  * @self: a #JoyPlayer
+  *
+  * Returns: the number of events in the recording.
+  */
+guint64 joy_player_get_event_count(JoyPlayer* self) {
+	g_return_val_if_fail(JOY_IS_PLAYER(self), 0);
+	return self->priv->nevents;
+}
+
+/**
+  * joy_player_get_position:
+  * @self: a #JoyPlayer
+  *
+  * Get the number of the next event that will be handed to the
+  * #JoyStick. Events that were handed over may not have been issued by
+  * the #JoyStick yet.
+  *
+  * Returns: the position of the playback, from 0 up to
+  * joy_player_get_event_count().
+  */
+guint64 joy_player_get_position(JoyPlayer* self) {
+	g_return_val_if_fail(JOY_IS_PLAYER(self), 0);
+	return self->priv->pos;
+}
+
+/**
+  * joy_player_seek:
+  * @self: a #JoyPlayer
+  * @event: the number of the event to continue playback with
+  *
+  * Continue playback at another point of the recording. Events that were
+  * handed over to the #JoyStick but that it has not read yet are
+  * discarded, and the #JoyStick is told the state of the joystick at the
+  * new position, as if it had just been opened. The time between @event
+  * and the event before it is not waited for.
+  *
+  * Returns: %FALSE if @event is beyond the end of the recording, or
+  * playback has ended.
+  */
+gboolean joy_player_seek(JoyPlayer* self, guint64 event) {
+	g_return_val_if_fail(JOY_IS_PLAYER(self), FALSE);
+	if(event > self->priv->nevents || self->priv->wfd < 0) {
+		return FALSE;
+	}
+	self->priv->pos = event;
+	if(self->priv->playing) {
+		gint32 axes[JOY_STICK_MAX_AXES];
+		guint64 buttons[JOY_STICK_MAX_BUTTONS / 64];
+
+		joy_player_state(self, event, axes, buttons);
+		_joy_record_reset(self->priv->rfd, self->priv->wfd, self->priv->hdr->naxes, axes, self->priv->hdr->nbuts, buttons);
+	}
+	joy_player_restart(self);
+	return TRUE;
+}
+
+/**
+  * joy_player_set_realtime:
+  * @self: a #JoyPlayer
+  * @realtime: whether to play events at the pace at which they were
+  * recorded
+  *
+  * Set the #JoyPlayer:realtime property.
+  */
+void joy_player_set_realtime(JoyPlayer* self, gboolean realtime) {
+	g_return_if_fail(JOY_IS_PLAYER(self));
+	g_object_set(G_OBJECT(self), "realtime", realtime, NULL);
+}
+
+/* The backend */
+
+static int replay_open(const gchar* devnode, gpointer* data) {
+	JoyPlayer* self;
+	gint32 axes[JOY_STICK_MAX_AXES];
+	guint64 buttons[JOY_STICK_MAX_BUTTONS / 64];
+	int fd;
+
+	G_LOCK(players);
+	self = players ? g_hash_table_lookup(players, devnode) : NULL;
+	if(self) {
+		g_object_ref(self);
+	}
+	G_UNLOCK(players);
+	if(!self) {
+		errno = ENOENT;
+		return -1;
+	}
+	if(self->priv->wfd < 0) {
+		g_object_unref(self);
+		errno = ENODEV;
+		return -1;
+	}
+	joy_player_state(self, self->priv->pos, axes, buttons);
+	fd = _joy_record_open(self->priv->rfd, self->priv->wfd, self->priv->hdr->naxes, axes, self->priv->hdr->nbuts, buttons);
+	if(fd < 0) {
+		g_object_unref(self);
+		return -1;
+	}
+	self->priv->playing = TRUE;
+	joy_player_restart(self);
+	*data = self;
+	return fd;
+}
+
+static gboolean replay_probe(int fd G_GNUC_UNUSED, JoyDeviceInfo* info, gpointer* data) {
+	JoyPlayer* self = *data;
+	const JoyRecHeader* hdr;
+
+	if(!self) {
+		return FALSE;
+	}
+	hdr = self->priv->hdr;
+	info->naxes = hdr->naxes;
+	info->nbuts = hdr->nbuts;
+	memcpy(info->axmap, hdr->axmap, sizeof(info->axmap));
+	memcpy(info->butmap, hdr->butmap, sizeof(info->butmap));
+	memcpy(info->axmin, hdr->axmin, sizeof(info->axmin));
+	memcpy(info->axmax, hdr->axmax, sizeof(info->axmax));
+	g_strlcpy(info->name, hdr->name, sizeof(info->name));
+	return TRUE;
+}
+
+const JoyBackend _joy_backend_replay = {
+	"replay",
+	sizeof(JoyRecord),
+	REPLAY_PREFIX,
+	replay_open,
+	replay_probe,
+	_joy_record_convert,
+	NULL,	/* grab */
+	g_object_unref,
+};
+
+/* The object */
+
+static void player_instance_init(GTypeInstance* instance, gpointer g_class G_GNUC_UNUSED) {
+	JoyPlayer* self = JOY_PLAYER(instance);
+
+	self->priv = g_new0(JoyPlayerPrivate, 1);
+	self->priv->rfd = self->priv->wfd = -1;
+	self->priv->realtime = TRUE;
+	self->priv->devnode = g_strdup_printf(REPLAY_PREFIX "%d", g_atomic_int_add(&serial, 1));
+	G_LOCK(players);
+	if(!players) {
+		players = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+	g_hash_table_insert(players, self->priv->devnode, self);
+	G_UNLOCK(players);
+}
+
+static void player_get_property(GObject* object, guint property_id, GValue *value, GParamSpec *pspec) {
+	JoyPlayer *self = JOY_PLAYER(object);
+
+	switch(property_id) {
+	case JOY_PLAYER_DEVNODE:
+		g_value_set_string(value, self->priv->devnode);
+		break;
+	case JOY_PLAYER_REALTIME:
+		g_value_set_boolean(value, self->priv->realtime);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+static void player_set_property(GObject* object, guint property_id, const GValue *value, GParamSpec *pspec) {
+	JoyPlayer *self = JOY_PLAYER(object);
+
+	switch(property_id) {
+	case JOY_PLAYER_REALTIME:
+		self->priv->realtime = g_value_get_boolean(value);
+		if(self->priv->map) {
+			joy_player_restart(self);
+		}
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+static void player_finalize(GObject* object) {
+	JoyPlayer* self = JOY_PLAYER(object);
+
+	G_LOCK(players);
+	g_hash_table_remove(players, self->priv->devnode);
+	G_UNLOCK(players);
+	if(self->priv->pump) {
+		g_source_destroy(self->priv->pump);
+		g_source_unref(self->priv->pump);
+	}
+	if(self->priv->wfd >= 0) {
+		close(self->priv->wfd);
+	}
+	if(self->priv->rfd >= 0) {
+		close(self->priv->rfd);
+	}
+	if(self->priv->map) {
+		munmap(self->priv->map, self->priv->size);
+	}
+	g_free(self->priv->devnode);
+	g_free(self->priv);
+	player_parent_class->finalize(object);
+}
+
+static void player_class_init(gpointer g_class, gpointer g_class_data G_GNUC_UNUSED) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(g_class);
+
+	player_parent_class = g_type_class_peek_parent(g_class);
+	gobject_class->get_property = player_get_property;
+	gobject_class->set_property = player_set_property;
+	gobject_class->finalize = player_finalize;
+/**
+ * JoyPlayer:devnode:
+ *
+ * The name under which joy_stick_open() finds the recording.
+ */
+	player_props[JOY_PLAYER_DEVNODE] =
+	  g_param_spec_string("devnode",
+				    "Device node",
+				    "The name under which joy_stick_open() finds the recording",
+				    NULL,
+				    G_PARAM_READABLE);
+/**
+ * JoyPlayer:realtime:
+ *
+ * If %TRUE, events are handed to the #JoyStick at the pace at which they
+ * were recorded, and keep the time between them. If %FALSE, they are
+ * handed over as fast as the #JoyStick reads them, with the time at
+ * which they were handed over; this is useful to run a recording through
+ * an application as a test.
+ */
+	player_props[JOY_PLAYER_REALTIME] =
+	  g_param_spec_boolean("realtime",
+				    "Realtime",
+				    "Whether events are played at the pace at which they were recorded",
+				    TRUE,
+				    G_PARAM_READWRITE);
+	g_object_class_install_properties(gobject_class, JOY_PLAYER_PROP_COUNT, player_props);
+}
+
+GType joy_player_get_type(void) {
+	static GType type = 0;
+	if(!type) {
+		static const GTypeInfo info = {
+			sizeof(JoyPlayerClass),
+			NULL,	/* base_init */
+			NULL,	/* base_finalize */
+			player_class_init,	/* class_init */
+			NULL,	/* class_finalize */
+			NULL,	/* class_data */
+			sizeof(JoyPlayer),
+			0,	/* n_preallocs */
+			player_instance_init,
+		};
+		type = g_type_register_static(G_TYPE_OBJECT,
+					      "JoyPlayer",
+					      &info, 0);
+	}
+
+	return type;
+}
@@ -0,0 +1,108 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef LIBJOY_RECORDER_H
+#define LIBJOY_RECORDER_H
+
+#include <joy/joystick.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define JOY_TYPE_RECORDER		(joy_recorder_get_type())
+#define JOY_RECORDER(obj)		(G_TYPE_CHECK_INSTANCE_CAST((obj), JOY_TYPE_RECORDER, JoyRecorder))
+#define JOY_RECORDER_CLASS(vtable)	(G_TYPE_CHECK_CLASS_CAST((vtable), JOY_TYPE_RECORDER, JoyRecorderClass))
+#define JOY_IS_RECORDER(obj)		(G_TYPE_CHECK_INSTANCE_TYPE((obj), JOY_TYPE_RECORDER))
+#define JOY_IS_RECORDER_CLASS(vtable)	(G_TYPE_CHECK_CLASS_TYPE((vtable), JOY_TYPE_RECORDER))
+#define JOY_RECORDER_GET_CLASS(inst)	(G_TYPE_INSTANCE_GET_CLASS((inst), JOY_TYPE_RECORDER, JoyRecorderClass))
+
+#define JOY_TYPE_PLAYER		(joy_player_get_type())
+#define JOY_PLAYER(obj)		(G_TYPE_CHECK_INSTANCE_CAST((obj), JOY_TYPE_PLAYER, JoyPlayer))
+#define JOY_PLAYER_CLASS(vtable)	(G_TYPE_CHECK_CLASS_CAST((vtable), JOY_TYPE_PLAYER, JoyPlayerClass))
+#define JOY_IS_PLAYER(obj)		(G_TYPE_CHECK_INSTANCE_TYPE((obj), JOY_TYPE_PLAYER))
+#define JOY_IS_PLAYER_CLASS(vtable)	(G_TYPE_CHECK_CLASS_TYPE((vtable), JOY_TYPE_PLAYER))
+#define JOY_PLAYER_GET_CLASS(inst)	(G_TYPE_INSTANCE_GET_CLASS((inst), JOY_TYPE_PLAYER, JoyPlayerClass))
+
+typedef struct _JoyRecorder JoyRecorder;
+typedef struct _JoyRecorderClass JoyRecorderClass;
+typedef struct _JoyRecorderPrivate JoyRecorderPrivate;
+
+typedef struct _JoyPlayer JoyPlayer;
+typedef struct _JoyPlayerClass JoyPlayerClass;
+typedef struct _JoyPlayerPrivate JoyPlayerPrivate;
+
+/**
+  * JoyRecorder:
+  *
+  * Opaque object representing a recording of the events of a #JoyStick
+  * that is being written
+  */
+struct _JoyRecorder {
+	/*< private >*/
+	GObject parent;
+	JoyRecorderPrivate *priv;
+};
+
+/**
+  * JoyRecorderClass:
+  */
+struct _JoyRecorderClass {
+	/*< private >*/
+	GObjectClass parent;
+};
+
+/**
+  * JoyPlayer:
+  *
+  * Opaque object representing a recording that is played back as a
+  * joystick
+  */
+struct _JoyPlayer {
+	/*< private >*/
+	GObject parent;
+	JoyPlayerPrivate *priv;
+};
+
+/**
+  * JoyPlayerClass:
+  */
+struct _JoyPlayerClass {
+	/*< private >*/
+	GObjectClass parent;
+};
+
+/* constructors */
+JoyRecorder* joy_recorder_new(JoyStick* stick, const gchar* path, guint interval, GError** err);
+JoyPlayer* joy_player_new(const gchar* path, GError** err);
+/* instance functions */
+gboolean joy_recorder_stop(JoyRecorder* self, GError** err);
+guint64 joy_recorder_get_event_count(JoyRecorder* self);
+const gchar* joy_player_get_devnode(JoyPlayer* self);
+guint64 joy_player_get_event_count(JoyPlayer* self);
+guint64 joy_player_get_position(JoyPlayer* self);
+gboolean joy_player_seek(JoyPlayer* self, guint64 event);
+void joy_player_set_realtime(JoyPlayer* self, gboolean realtime);
+
+/* type handling functions */
+GType joy_recorder_get_type(void) G_GNUC_PURE;
+GType joy_player_get_type(void) G_GNUC_PURE;
+
+G_END_DECLS
+
+#endif // LIBJOY_RECORDER_H
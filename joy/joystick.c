@@ -17,13 +17,23 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdint.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -32,217 +42,1876 @@
 
 #include <libudev.h>
 
-#include <glib-unix.h>
+#include <glib-unix.h>
+
+#include <joy/joystick.h>
+#include <joy/joymanager.h>
+#include <joy-marshallers.h>
+#include "joy-private.h"
+#include "joy-trace.h"
+
+/* These two were shamelessly stolen from jstest.c */
+char* axis_names[ABS_MAX + 1] = {
+"X", "Y", "Z", "Rx", "Ry", "Rz", "Throttle", "Rudder", 
+"Wheel", "Gas", "Brake", "?", "?", "?", "?", "?",
+"Hat0X", "Hat0Y", "Hat1X", "Hat1Y", "Hat2X", "Hat2Y", "Hat3X", "Hat3Y",
+"?", "?", "?", "?", "?", "?", "?", 
+};
+
+char* button_names[KEY_MAX - BTN_MISC + 1] = {
+"Btn0", "Btn1", "Btn2", "Btn3", "Btn4", "Btn5", "Btn6", "Btn7", "Btn8", "Btn9", "?", "?", "?", "?", "?", "?",
+"LeftBtn", "RightBtn", "MiddleBtn", "SideBtn", "ExtraBtn", "ForwardBtn", "BackBtn", "TaskBtn", "?", "?", "?", "?", "?", "?", "?", "?",
+"Trigger", "ThumbBtn", "ThumbBtn2", "TopBtn", "TopBtn2", "PinkieBtn", "BaseBtn", "BaseBtn2", "BaseBtn3", "BaseBtn4", "BaseBtn5", "BaseBtn6", "BtnDead",
+"BtnA", "BtnB", "BtnC", "BtnX", "BtnY", "BtnZ", "BtnTL", "BtnTR", "BtnTL2", "BtnTR2", "BtnSelect", "BtnStart", "BtnMode", "BtnThumbL", "BtnThumbR", "?",
+"?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", 
+"WheelBtn", "Gear up",
+};
+
+/**
+  * SECTION:joystick
+  * @short_description: a joystick interface
+  * @see_also: #JoyModel
+  * @stability: Unstable
+  * @include: joy/joystick.h
+  */
+
+#define DEFAULT_BATCH 64
+#define RING_SIZE 1024
+#define CACHE_LINE 64
+
+/* Counters that the reader thread updates in %JOY_MODE_THREAD mode */
+#define COUNTER_ADD(c, n) __atomic_fetch_add(&(c), (n), __ATOMIC_RELAXED)
+#define COUNTER_GET(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+
+/* The number of devices that joy_stick_enumerate() opens at once */
+#define ENUM_THREADS 16
+
+static GHashTable* object_index = NULL;
+/* identity -> JoyStick, for the persistent joysticks that were
+ * disconnected and wait for their device to return */
+static GHashTable* lost_index = NULL;
+
+/* Signal details for every possible js_event.number, so that the event
+ * path does not need to format and intern a string for each event. */
+static GQuark detail_quarks[G_MAXUINT8 + 1];
+
+typedef struct _JoyProbe JoyProbe;
+
+/* A device node that was opened and identified, but not handed to a
+ * JoyStick yet; fd is -1 if that failed */
+struct _JoyProbe {
+	const gchar* devname;
+	int fd;
+	const JoyBackend* backend;
+	gpointer data;
+	JoyDeviceInfo info;
+};
+
+typedef struct _JoyAxis JoyAxis;
+
+/* Coalescing state of a single axis. Axis events that arrive within the
+ * axis' interval after the last issued event are not dropped; rather, the
+ * latest value is remembered (along with the time of its event) and issued
+ * once the interval has passed. */
+struct _JoyAxis {
+	gint64 last;
+	gint64 time;
+	guint32 intv;
+	guint16 thresh;
+	gboolean pending;
+	gint32 value;
+	gint32 emitted;
+};
+
+/* Latency histograms: four buckets per power of two, so that a bucket is
+ * never wider than a quarter of its lower bound. Values up to 3 have a
+ * bucket of their own; everything from 2^32 us (over an hour) up lands in
+ * the last bucket. */
+#define HIST_BUCKETS 124
+
+typedef struct _JoyHistogram JoyHistogram;
+
+struct _JoyHistogram {
+	guint64 count;
+	gint64 max;
+	guint32 buckets[HIST_BUCKETS];
+};
+
+typedef struct _JoyLatencyData JoyLatencyData;
+
+struct _JoyLatencyData {
+	JoyHistogram read;
+	JoyHistogram dispatch;
+	JoyHistogram total;
+};
+
+typedef struct _JoyRing JoyRing;
+
+/* Single-producer, single-consumer ring of events, filled by the reader
+ * thread in %JOY_MODE_THREAD mode and drained on the owning main context.
+ * head is only written by the reader thread, tail only by the main
+ * context. */
+struct _JoyRing {
+	gint head;
+	gint tail;
+	gint notify;
+	gint hangup;
+	gint overflows;
+	JoyEvent evs[RING_SIZE];
+};
+
+typedef struct _JoyValues JoyValues;
+
+/* The values of the axes and buttons, sized for the device: n_words words
+ * of button bits, followed by n_axes axis values. The report that is being
+ * built (see joy_stick_dispatch()) has, after those, a word of changed
+ * axis bits and n_words words of changed button bits; see
+ * joy_values_changed(). For the usual gamepad, each of them fits in a
+ * single cache line. */
+struct _JoyValues {
+	gint64 time;
+	guint8 n_axes;
+	guint8 n_buttons;
+	guint8 n_words;
+	guint64 words[];
+};
+
+static inline gint32* joy_values_axes(JoyValues* values) {
+	return (gint32*)(values->words + values->n_words);
+}
+
+static inline guint64* joy_values_changed(JoyValues* values) {
+	return values->words + values->n_words + (values->n_axes + 1) / 2;
+}
+
+/* The members used for every event come first, so that handling an event
+ * touches as few cache lines as possible; the state, the report, and the
+ * axis and button maps are only as large as the device requires. */
+struct _JoyStickPrivate {
+	int fd;
+	JoyMode mode;
+	gint seq;
+	uint8_t nbuts;
+	uint8_t naxes;
+	gboolean ready;
+	JoyValues* state;
+	JoyAxis* axes;
+	JoyValues* report;
+	gint64 evtime;
+	gint measure;
+	JoyLatencyData* latency;
+	const JoyBackend* backend;
+	gpointer backend_data;
+	guchar* rawbuf;
+	JoyEvent* evbuf;
+	guint batch;
+	/* Signal handlers may change the stick while events are being
+	 * issued: busy counts the batches in progress, newbatch is the
+	 * batch size to resize the buffers to when they are done, and
+	 * epoch changes whenever the device is stopped, closed, or given
+	 * a new layout, which makes the events in progress stale */
+	guint busy;
+	guint newbatch;
+	guint epoch;
+	gint64 next_flush;
+	GSource* flush;
+	uint8_t* axmap;
+	uint16_t* butmap;
+	gint32* axmin;
+	gint32* axmax;
+	guint axintv;
+	guint axthresh;
+	gboolean grab;
+	gchar name[JOY_NAME_LEN];
+	gchar* devname;
+	GMainContext* context;
+	GSource* source;
+	gpointer hub;
+	GThread* thread;
+	int wake[2];
+	JoyRing* ring;
+	GSource* ringsrc;
+	guint overflows;
+	guint64 nread;
+	guint64 nreadcalls;
+	guint64 nemitted;
+	guint64 ncoalesced;
+	guint64 koverflows;
+	gboolean changed;
+	gboolean resyncing;
+	GMutex taplock;
+	JoyStickTap tap;
+	gpointer tapdata;
+	gint thread_prio;
+	gint thread_cpu;
+	gboolean thread_mlock;
+	gboolean persistent;
+	gchar* identity;
+	JoyStickReport* repout;
+	GSList* retired;
+	gint64 reconnect_latency;
+};
+
+typedef struct _JoyStickSource JoyStickSource;
+
+struct _JoyStickSource {
+	GSource source;
+	JoyStick* stick;
+	gpointer tag;
+};
+
+enum {
+	JOY_OPEN = 1,
+	JOY_BUTCNT,
+	JOY_AXCNT,
+	JOY_NAME,
+	JOY_DEVNAME,
+	JOY_INTV,
+	JOY_BATCH,
+	JOY_THRESH,
+	JOY_PRIO,
+	JOY_CPU,
+	JOY_MLOCK,
+	JOY_OVERFLOWS,
+	JOY_GRAB,
+	JOY_BACKEND,
+	JOY_LATENCY,
+	JOY_EVREAD,
+	JOY_EVEMITTED,
+	JOY_EVCOALESCED,
+	JOY_READCALLS,
+	JOY_KOVERFLOWS,
+	JOY_PERSISTENT,
+	JOY_IDENTITY,
+	JOY_RECONNECT_LATENCY,
+	JOY_PROP_COUNT,
+};
+
+static GParamSpec *props[JOY_PROP_COUNT] = { NULL, };
+
+/** 
+  * joy_stick_open: (constructor)
+  * @devname: the device node of the joystick to open
+  * 
+  * This function creates a new #JoyStick object.
+  *
+  * @devname may be either a node of the evdev interface
+  * (`/dev/input/event*`) or one of the legacy joystick interface
+  * (`/dev/input/js*`). The former is preferred: it reports the native
+  * values of axes, timestamps with microsecond resolution, and allows
+  * grabbing the device (see #JoyStick:grab). It may also be the device
+  * node of a #JoyVirtual or a #JoyPlayer.
+  *
+  * Warning: this function always returns a #JoyStick; but if the
+  * device node cannot be opened for some reason, then it will not issue
+  * any events. Use the #JoyStick:open property to verify that
+  * it can do anything useful.
+  *
+  * Returns: a newly-allocated #JoyStick.
+  */
+JoyStick* joy_stick_open(const gchar* devname) {
+	JoyStick* js;
+	if(!object_index || !g_hash_table_contains(object_index, devname)) {
+		js = g_object_new(JOY_TYPE_STICK, "devnode", devname, NULL);
+		/* Since it's base_init which creates our hash table, it might
+		 * not actually exist until the above returns */
+		g_hash_table_insert(object_index, js->priv->devname, js);
+		JOY_TRACE_OPEN(js->priv->devname);
+	} else {
+		js = JOY_STICK(g_hash_table_lookup(object_index, devname));
+		g_object_ref(G_OBJECT(js));
+	}
+	return js;
+}
+
+/** 
+  * joy_stick_enum_free: (skip)
+  * @enumeration: the enumeration to free.
+  *
+  * Free the return value of joy_stick_enumerate(). This is a
+  * convenience function; it simply calls g_object_unref() on each of
+  * the elements of the list, and frees the list nodes.
+  *
+  */
+void joy_stick_enum_free(GList* enumeration) {
+	while(enumeration) {
+		g_object_unref(JOY_STICK(enumeration->data));
+		GList* next = enumeration->next;
+		g_free(enumeration);
+		enumeration = next;
+	}
+}
+
+/* Whether dev is the device node through which the joystick it belongs
+ * to should be opened: the evdev node if the joystick has one, the joydev
+ * node otherwise. */
+gboolean _joy_stick_is_preferred_node(struct udev_device* dev) {
+	const char* name = udev_device_get_sysname(dev);
+	struct udev_device* parent;
+	struct udev_enumerate* enumer;
+	gboolean found;
+
+	if(g_str_has_prefix(name, "event")) {
+		return g_strcmp0(udev_device_get_property_value(dev, "ID_INPUT_JOYSTICK"), "1") == 0;
+	}
+	if(!g_str_has_prefix(name, "js")) {
+		return FALSE;
+	}
+	parent = udev_device_get_parent(dev);
+	if(!parent) {
+		return TRUE;
+	}
+	enumer = udev_enumerate_new(udev_device_get_udev(dev));
+	udev_enumerate_add_match_parent(enumer, parent);
+	udev_enumerate_add_match_sysname(enumer, "event*");
+	udev_enumerate_add_match_property(enumer, "ID_INPUT_JOYSTICK", "1");
+	udev_enumerate_scan_devices(enumer);
+	found = udev_enumerate_get_list_entry(enumer) != NULL;
+	udev_enumerate_unref(enumer);
+	return !found;
+}
+
+static gboolean joy_probe_open(JoyProbe* probe);
+static void joy_probe_discard(JoyProbe* probe);
+static JoyStick* joy_stick_open_probed(JoyProbe* probe);
+
+/* The device nodes of all joysticks, through the preferred interface,
+ * in the order in which udev lists them */
+static GPtrArray* joy_stick_scan(void) {
+	GPtrArray* nodes = g_ptr_array_new_with_free_func(g_free);
+	struct udev* udev;
+	struct udev_enumerate *enumer;
+	struct udev_list_entry *devices, *dev_list_entry;
+	struct udev_device *dev;
+
+	udev = udev_new();
+	if(!udev) {
+		return nodes;
+	}
+
+	enumer = udev_enumerate_new(udev);
+	udev_enumerate_add_match_subsystem(enumer, "input");
+	/* Matches on the sysname are or'ed; this skips keyboards, mice,
+	 * and the input devices that are not device nodes at all */
+	udev_enumerate_add_match_sysname(enumer, "event*");
+	udev_enumerate_add_match_sysname(enumer, "js*");
+	udev_enumerate_scan_devices(enumer);
+	devices = udev_enumerate_get_list_entry(enumer);
+	udev_list_entry_foreach(dev_list_entry, devices) {
+		const char* path = udev_list_entry_get_name(dev_list_entry);
+		dev = udev_device_new_from_syspath(udev, path);
+		if(!dev) {
+			continue;
+		}
+		if(udev_device_get_devnode(dev) && _joy_stick_is_preferred_node(dev)) {
+			g_ptr_array_add(nodes, g_strdup(udev_device_get_devnode(dev)));
+		}
+		udev_device_unref(dev);
+	}
+	udev_enumerate_unref(enumer);
+	udev_unref(udev);
+	return nodes;
+}
+
+static void joy_probe_thread(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+	joy_probe_open(data);
+}
+
+/** 
+  * joy_stick_enumerate:
+  *
+  * Enumerate all joystick device nodes on this system. For joysticks that
+  * are available through both the evdev interface and the legacy joystick
+  * interface, only the evdev node is returned.
+  *
+  * The devices are opened in parallel, so that one that is slow to
+  * respond does not hold up the others; but this function still only
+  * returns once all of them are open. See joy_stick_enumerate_async()
+  * for a variant that does not block.
+  *
+  * See also joy_stick_enum_free()
+  *
+  * Returns: (element-type Joy.Stick) (transfer full): a #GList of #JoyStick
+  * objects, or %NULL in case of error
+  */
+GList* joy_stick_enumerate() {
+	GList* retval = NULL;
+	GPtrArray* nodes = joy_stick_scan();
+	JoyProbe* probes = g_new0(JoyProbe, nodes->len);
+	GThreadPool* pool = NULL;
+
+	if(nodes->len > 1) {
+		pool = g_thread_pool_new(joy_probe_thread, NULL, MIN(nodes->len, ENUM_THREADS), FALSE, NULL);
+	}
+	for(guint i=0; i<nodes->len; i++) {
+		probes[i].devname = g_ptr_array_index(nodes, i);
+		if(pool) {
+			g_thread_pool_push(pool, &probes[i], NULL);
+		} else {
+			joy_probe_open(&probes[i]);
+		}
+	}
+	if(pool) {
+		/* Waits for all of them */
+		g_thread_pool_free(pool, FALSE, TRUE);
+	}
+	/* The JoyStick objects themselves belong to this thread */
+	for(guint i=0; i<nodes->len; i++) {
+		retval = g_list_prepend(retval, joy_stick_open_probed(&probes[i]));
+	}
+	g_free(probes);
+	g_ptr_array_unref(nodes);
+	return g_list_reverse(retval);
+}
+
+typedef struct _JoyEnumeration JoyEnumeration;
+
+struct _JoyEnumeration {
+	JoyStickFoundFunc found;
+	gpointer found_data;
+	GDestroyNotify found_destroy;
+	GPtrArray* nodes;
+	JoyProbe* probes;
+	JoyStick** sticks;
+	guint pending;
+};
+
+static void joy_enumeration_free(gpointer data) {
+	JoyEnumeration* e = data;
+
+	if(e->nodes) {
+		for(guint i=0; i<e->nodes->len; i++) {
+			joy_probe_discard(&e->probes[i]);
+			if(e->sticks[i]) {
+				g_object_unref(e->sticks[i]);
+			}
+		}
+		g_ptr_array_unref(e->nodes);
+	}
+	if(e->found_destroy) {
+		e->found_destroy(e->found_data);
+	}
+	g_free(e->probes);
+	g_free(e->sticks);
+	g_free(e);
+}
+
+static void joy_stick_scan_thread(GTask* task, gpointer source G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED, GCancellable* cancellable G_GNUC_UNUSED) {
+	g_task_return_pointer(task, joy_stick_scan(), (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void joy_stick_probe_thread(GTask* task, gpointer source G_GNUC_UNUSED, gpointer data, GCancellable* cancellable G_GNUC_UNUSED) {
+	if(g_task_return_error_if_cancelled(task)) {
+		return;
+	}
+	joy_probe_open(data);
+	g_task_return_boolean(task, TRUE);
+}
+
+static void joy_enumeration_finish(GTask* task) {
+	JoyEnumeration* e = g_task_get_task_data(task);
+	GList* retval = NULL;
+
+	if(g_task_return_error_if_cancelled(task)) {
+		return;
+	}
+	for(guint i=e->nodes->len; i>0; i--) {
+		retval = g_list_prepend(retval, e->sticks[i - 1]);
+		e->sticks[i - 1] = NULL;
+	}
+	g_task_return_pointer(task, retval, (GDestroyNotify)joy_stick_enum_free);
+}
+
+/* Called on the context of the caller of joy_stick_enumerate_async()
+ * when a device was opened (or failed to) */
+static void joy_stick_probed(GObject* source G_GNUC_UNUSED, GAsyncResult* result, gpointer user_data) {
+	GTask* task = user_data;
+	JoyEnumeration* e = g_task_get_task_data(task);
+	JoyProbe* probe = g_task_get_task_data(G_TASK(result));
+	guint i = probe - e->probes;
+
+	if(g_task_propagate_boolean(G_TASK(result), NULL) && !g_cancellable_is_cancelled(g_task_get_cancellable(task))) {
+		e->sticks[i] = joy_stick_open_probed(probe);
+		if(e->found) {
+			e->found(e->sticks[i], e->found_data);
+		}
+	} else {
+		joy_probe_discard(probe);
+	}
+	/* Even when cancelled, wait for all workers: they use e */
+	if(--e->pending == 0) {
+		joy_enumeration_finish(task);
+	}
+	g_object_unref(task);
+}
+
+static void joy_stick_scanned(GObject* source G_GNUC_UNUSED, GAsyncResult* result, gpointer user_data) {
+	GTask* task = user_data;
+	JoyEnumeration* e = g_task_get_task_data(task);
+	GError* err = NULL;
+
+	e->nodes = g_task_propagate_pointer(G_TASK(result), &err);
+	if(!e->nodes) {
+		g_task_return_error(task, err);
+		g_object_unref(task);
+		return;
+	}
+	e->probes = g_new0(JoyProbe, e->nodes->len);
+	e->sticks = g_new0(JoyStick*, e->nodes->len);
+	e->pending = e->nodes->len;
+	if(e->pending == 0) {
+		joy_enumeration_finish(task);
+	}
+	for(guint i=0; i<e->nodes->len; i++) {
+		GTask* probe = g_task_new(NULL, g_task_get_cancellable(task), joy_stick_probed, g_object_ref(task));
+
+		e->probes[i].devname = g_ptr_array_index(e->nodes, i);
+		e->probes[i].fd = -1;
+		g_task_set_task_data(probe, &e->probes[i], NULL);
+		g_task_run_in_thread(probe, joy_stick_probe_thread);
+		g_object_unref(probe);
+	}
+	g_object_unref(task);
+}
+
+/**
+  * joy_stick_enumerate_async:
+  * @cancellable: (nullable): a #GCancellable, or %NULL
+  * @found: (nullable) (scope notified): a function to call for each
+  * joystick as soon as it is open, or %NULL
+  * @found_data: data to pass to @found
+  * @found_destroy: (nullable): a function to free @found_data once
+  * enumeration is finished, or %NULL
+  * @callback: a function to call when all joysticks were found
+  * @user_data: data to pass to @callback
+  *
+  * Enumerate all joystick device nodes on this system, like
+  * joy_stick_enumerate(), without blocking the calling thread: the scan
+  * and the opening of every device happen on worker threads, all devices
+  * at the same time. The #JoyStick objects are created on the
+  * thread-default #GMainContext of the caller, in which @found and
+  * @callback are called, too.
+  *
+  * Call joy_stick_enumerate_finish() from @callback to get the result.
+  */
+void joy_stick_enumerate_async(GCancellable* cancellable, JoyStickFoundFunc found, gpointer found_data, GDestroyNotify found_destroy, GAsyncReadyCallback callback, gpointer user_data) {
+	GTask* task = g_task_new(NULL, cancellable, callback, user_data);
+	GTask* scan = g_task_new(NULL, cancellable, joy_stick_scanned, task);
+	JoyEnumeration* e = g_new0(JoyEnumeration, 1);
+
+	e->found = found;
+	e->found_data = found_data;
+	e->found_destroy = found_destroy;
+	g_task_set_source_tag(task, joy_stick_enumerate_async);
+	g_task_set_task_data(task, e, joy_enumeration_free);
+	g_task_run_in_thread(scan, joy_stick_scan_thread);
+	g_object_unref(scan);
+}
+
+/**
+  * joy_stick_enumerate_finish:
+  * @result: the #GAsyncResult passed to the callback of
+  * joy_stick_enumerate_async()
+  * @err: return location for a #GError, or %NULL
+  *
+  * Get the result of joy_stick_enumerate_async().
+  *
+  * Returns: (element-type Joy.Stick) (transfer full): a #GList of #JoyStick
+  * objects, in the same order as joy_stick_enumerate() would return them;
+  * or %NULL, with @err set to %G_IO_ERROR_CANCELLED if the enumeration
+  * was cancelled. Free it with joy_stick_enum_free().
+  */
+GList* joy_stick_enumerate_finish(GAsyncResult* result, GError** err) {
+	g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+	return g_task_propagate_pointer(G_TASK(result), err);
+}
+
+/** 
+  * joy_stick_describe_unopened:
+  * @devname: the path of the joystick device node to describe.
+  *
+  * Describe a joystick without first calling joy_stick_open().
+  *
+  * Note that to get the requested information, this function will open
+  * the joystick device, perform the correct ioctl() to retrieve the
+  * requested data, and close the device again; so this function is no
+  * substitute for when joy_stick_open() followed by
+  * joy_stick_describe() fails for some reason (e.g., permission issues)
+  *
+  * Returns: (transfer full): the identity string of the joystick, or %NULL in
+  * case of error (with @err set appropriately)
+  */
+gchar* joy_stick_describe_unopened(gchar* devname) {
+	JoyStick* joy = joy_stick_open(devname);
+	gchar* retval = g_strdup(joy_stick_describe(joy));
+	g_object_unref(joy);
+	return retval;
+}
+
+static void joy_stick_emit_axis(JoyStick* self, guint8 number, JoyAxis* axis, gint64 now) {
+	JoyStickClass* klass = JOY_STICK_GET_CLASS(self);
+
+	axis->emitted = axis->value;
+	axis->last = now;
+	axis->pending = FALSE;
+	self->priv->evtime = axis->time;
+	self->priv->nemitted++;
+	if(g_signal_has_handler_pending(self, klass->axis_moved, detail_quarks[number], FALSE)) {
+		gint64 begin = joy_trace_emit_begin(self->priv->devname, JOY_TRACE_SIGNAL_AXIS_MOVED, number, axis->value);
+
+		g_signal_emit(self, klass->axis_moved, detail_quarks[number], number, (gint)axis->value);
+		joy_trace_emit_end(self->priv->devname, JOY_TRACE_SIGNAL_AXIS_MOVED, number, axis->value, begin);
+	}
+}
+
+static void joy_stick_schedule_flush(JoyStick* self, gint64 when) {
+	if(self->priv->next_flush >= 0 && self->priv->next_flush <= when) {
+		return;
+	}
+	self->priv->next_flush = when;
+	if(self->priv->flush) {
+		g_source_set_ready_time(self->priv->flush, when);
+	}
+}
+
+/* Issue the pending value of every axis whose interval has passed, and
+ * arrange to be called again for the ones whose interval has not */
+static void joy_stick_flush_axes(JoyStick* self) {
+	gint64 now = g_get_monotonic_time();
+	gint64 next = -1;
+
+	for(guint i=0; i<self->priv->naxes; i++) {
+		JoyAxis* axis = &(self->priv->axes[i]);
+		gint64 due;
+
+		if(!axis->pending) {
+			continue;
+		}
+		due = axis->last + (gint64)axis->intv * 1000;
+		if(due <= now) {
+			joy_stick_emit_axis(self, i, axis, now);
+		} else if(next < 0 || due < next) {
+			next = due;
+		}
+	}
+	self->priv->next_flush = next;
+	if(self->priv->flush) {
+		g_source_set_ready_time(self->priv->flush, next);
+	}
+}
+
+static void joy_stick_axis_update(JoyStick* self, guint8 number, gint32 value, gint64 time) {
+	JoyAxis* axis = &(self->priv->axes[number]);
+	gint64 now;
+
+	if(axis->pending) {
+		/* The value we were holding back will never be issued */
+		self->priv->ncoalesced++;
+	}
+	axis->value = value;
+	axis->time = time;
+	if(axis->thresh && ABS((gint64)value - axis->emitted) < (gint64)axis->thresh) {
+		/* Jitter around the last issued value; nothing to report */
+		axis->pending = FALSE;
+		self->priv->ncoalesced++;
+		return;
+	}
+	now = g_get_monotonic_time();
+	if(!axis->intv || now >= axis->last + (gint64)axis->intv * 1000) {
+		joy_stick_emit_axis(self, number, axis, now);
+		return;
+	}
+	axis->pending = TRUE;
+	joy_stick_schedule_flush(self, axis->last + (gint64)axis->intv * 1000);
+}
+
+/* Record the new value of a button or axis. Returns FALSE if the event
+ * should not be issued. Must be called between joy_stick_state_begin() and
+ * joy_stick_state_end(). */
+static gboolean joy_stick_update(JoyStick* self, JoyEvent* ev) {
+	JoyValues* state = self->priv->state;
+	guint64 bit = G_GUINT64_CONSTANT(1) << (ev->number % 64);
+
+	/* When its buffer overflows, joydev sends the state of every axis and
+	 * button again, and evdev reports SYN_DROPPED, upon which the backend
+	 * fetches the state. Either way, a state dump that arrives after
+	 * regular events means events were lost. The dump itself rebuilds the
+	 * state; the report that ends it is marked, so that
+	 * #JoyStick::resynchronized is issued after it. */
+	if(ev->type == JOY_EVENT_SYNC) {
+		if(self->priv->resyncing) {
+			ev->flags |= JOY_EVENT_RESYNC;
+			self->priv->resyncing = FALSE;
+		}
+	} else if(ev->flags & JOY_EVENT_INIT) {
+		if(self->priv->changed) {
+			COUNTER_ADD(self->priv->koverflows, 1);
+			self->priv->changed = FALSE;
+			self->priv->resyncing = TRUE;
+		}
+	} else {
+		self->priv->changed = TRUE;
+	}
+	switch(ev->type) {
+		case JOY_EVENT_BUTTON:
+			if(ev->number >= state->n_buttons) {
+				return FALSE;
+			}
+			/* A state dump (when the device is opened, or after
+			 * the kernel dropped events) only matters where it
+			 * differs from what we already knew */
+			if((ev->flags & JOY_EVENT_INIT) && !!(state->words[ev->number / 64] & bit) == !!ev->value) {
+				return FALSE;
+			}
+			if(ev->value) {
+				state->words[ev->number / 64] |= bit;
+			} else {
+				state->words[ev->number / 64] &= ~bit;
+			}
+			break;
+		case JOY_EVENT_AXIS:
+			if(ev->number >= state->n_axes) {
+				return FALSE;
+			}
+			if((ev->flags & JOY_EVENT_INIT) && joy_values_axes(state)[ev->number] == ev->value) {
+				return FALSE;
+			}
+			joy_values_axes(state)[ev->number] = ev->value;
+			break;
+		case JOY_EVENT_SYNC:
+			break;
+		default:
+			return FALSE;
+	}
+	state->time = ev->time;
+	return TRUE;
+}
+
+/* The state block is published with a sequence lock: the sequence number
+ * is odd while the state is being written to, and readers retry until they
+ * have copied the state without the sequence number changing. There is
+ * only ever one writer: the thread that reads events from the device. */
+static void joy_stick_state_begin(JoyStick* self) {
+	g_atomic_int_inc(&self->priv->seq);
+}
+
+static void joy_stick_state_end(JoyStick* self) {
+	g_atomic_int_inc(&self->priv->seq);
+}
+
+/* Record a batch of events in the state block. Events that should not be
+ * issued are marked by clearing their type. */
+static void joy_stick_update_batch(JoyStick* self, JoyEvent* evs, gsize count) {
+	joy_stick_state_begin(self);
+	for(gsize i=0; i<count; i++) {
+		if(!joy_stick_update(self, &evs[i])) {
+			evs[i].type = JOY_EVENT_NONE;
+		}
+	}
+	joy_stick_state_end(self);
+}
+
+/* Issue the #JoyStick::report signal for the events since the last one,
+ * if anything changed */
+static void joy_stick_end_report(JoyStick* self, gint64 time) {
+	JoyValues* report = self->priv->report;
+	guint64* changed = joy_values_changed(report);
+	guint sig = JOY_STICK_GET_CLASS(self)->report;
+	guint64 any = 0;
+
+	for(guint i=0; i<=report->n_words; i++) {
+		any |= changed[i];
+	}
+	if(!any) {
+		return;
+	}
+	if(g_signal_has_handler_pending(self, sig, 0, FALSE)) {
+		JoyStickReport* out = self->priv->repout;
+		gint64 begin = joy_trace_emit_begin(self->priv->devname, JOY_TRACE_SIGNAL_REPORT, 0, 0);
+
+		/* Only the part that the device uses is ever written to */
+		out->time = time;
+		out->changed_axes = changed[0];
+		memcpy(out->changed_buttons, changed + 1, report->n_words * sizeof(guint64));
+		memcpy(out->buttons, report->words, report->n_words * sizeof(guint64));
+		memcpy(out->axes, joy_values_axes(report), report->n_axes * sizeof(gint32));
+		g_signal_emit(self, sig, 0, out);
+		joy_trace_emit_end(self->priv->devname, JOY_TRACE_SIGNAL_REPORT, 0, 0, begin);
+	}
+	memset(changed, 0, (report->n_words + 1) * sizeof(guint64));
+}
+
+/* Issue the signals for an event that has been recorded with
+ * joy_stick_update_batch(). The report is kept here rather than in the
+ * state block, since in %JOY_MODE_THREAD mode the state block may already
+ * be ahead of the events being issued. */
+static void joy_stick_dispatch(JoyStick* self, JoyEvent* ev) {
+	JoyStickClass* klass = JOY_STICK_GET_CLASS(self);
+	JoyValues* report = self->priv->report;
+	guint64* changed = joy_values_changed(report);
+	guint64 bit = G_GUINT64_CONSTANT(1) << (ev->number % 64);
+	GQuark detail;
+	guint sig;
+
+	detail = detail_quarks[ev->number];
+	switch(ev->type) {
+		case JOY_EVENT_BUTTON:
+			changed[1 + ev->number / 64] |= bit;
+			if(ev->value) {
+				report->words[ev->number / 64] |= bit;
+			} else {
+				report->words[ev->number / 64] &= ~bit;
+			}
+			sig = ev->value ? klass->button_pressed : klass->button_released;
+			self->priv->evtime = ev->time;
+			self->priv->nemitted++;
+			if(g_signal_has_handler_pending(self, sig, detail, FALSE)) {
+				gint tsig = ev->value ? JOY_TRACE_SIGNAL_BUTTON_PRESSED : JOY_TRACE_SIGNAL_BUTTON_RELEASED;
+				gint64 begin = joy_trace_emit_begin(self->priv->devname, tsig, ev->number, ev->value);
+
+				g_signal_emit(self, sig, detail, ev->number);
+				joy_trace_emit_end(self->priv->devname, tsig, ev->number, ev->value, begin);
+			}
+			break;
+		case JOY_EVENT_AXIS:
+			changed[0] |= bit;
+			joy_values_axes(report)[ev->number] = ev->value;
+			joy_stick_axis_update(self, ev->number, ev->value, ev->time);
+			break;
+		case JOY_EVENT_SYNC:
+			self->priv->evtime = ev->time;
+			joy_stick_end_report(self, ev->time);
+			if(ev->flags & JOY_EVENT_RESYNC) {
+				g_object_notify_by_pspec(G_OBJECT(self), props[JOY_KOVERFLOWS]);
+				g_signal_emit(self, klass->resynchronized, 0);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+static void joy_stick_stop(JoyStick* self);
+
+static void joy_stick_disconnect(JoyStick* self) {
+	joy_stick_stop(self);
+	JOY_TRACE_DISCONNECT(self->priv->devname);
+	g_hash_table_remove(object_index, self->priv->devname);
+	close(self->priv->fd);
+	self->priv->fd = -1;
+	self->priv->ready = FALSE;
+	if(self->priv->persistent && self->priv->identity) {
+		g_hash_table_insert(lost_index, self->priv->identity, self);
+	}
+	g_signal_emit(self, JOY_STICK_GET_CLASS(self)->disconnected, 0, NULL);
+}
+
+static guint joy_histogram_index(gint64 value) {
+	guint msb;
+
+	if(value < 4) {
+		return MAX(value, 0);
+	}
+	value = MIN(value, G_MAXUINT32);
+	msb = g_bit_storage(value) - 1;
+	return (msb - 1) * 4 + ((value >> (msb - 2)) & 3);
+}
+
+/* The highest value that lands in the given bucket */
+static gint64 joy_histogram_bucket_max(guint index) {
+	guint shift;
+
+	if(index < 4) {
+		return index;
+	}
+	shift = index / 4 - 1;
+	return ((gint64)(4 + index % 4 + 1) << shift) - 1;
+}
+
+static void joy_histogram_add(JoyHistogram* hist, gint64 value) {
+	value = MAX(value, 0);
+	hist->buckets[joy_histogram_index(value)]++;
+	hist->count++;
+	hist->max = MAX(hist->max, value);
+}
+
+static gint64 joy_histogram_percentile(JoyHistogram* hist, guint percent) {
+	guint64 target = (hist->count * percent + 99) / 100;
+	guint64 seen = 0;
+
+	if(!hist->count) {
+		return 0;
+	}
+	for(guint i=0; i<HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if(seen >= target) {
+			return MIN(joy_histogram_bucket_max(i), hist->max);
+		}
+	}
+	return hist->max;
+}
+
+static void joy_histogram_summarize(JoyHistogram* hist, JoyLatency* latency) {
+	latency->count = hist->count;
+	latency->p50 = joy_histogram_percentile(hist, 50);
+	latency->p99 = joy_histogram_percentile(hist, 99);
+	latency->max = hist->max;
+}
+
+/* Remember when the events were read, if anyone cares */
+static void joy_stick_stamp(JoyStick* self, JoyEvent* evs, gsize count) {
+	gint64 now;
+
+	if(!g_atomic_int_get(&self->priv->measure)) {
+		return;
+	}
+	now = g_get_monotonic_time();
+	for(gsize i=0; i<count; i++) {
+		evs[i].rtime = now;
+	}
+}
+
+static void joy_stick_measure(JoyStick* self, JoyEvent* ev, gint64 done) {
+	JoyLatencyData* latency = self->priv->latency;
+
+	/* Events that were read before measuring was enabled have no rtime */
+	if(!latency || !ev->rtime || (ev->type != JOY_EVENT_AXIS && ev->type != JOY_EVENT_BUTTON)) {
+		return;
+	}
+	joy_histogram_add(&latency->read, ev->rtime - ev->time);
+	if(done) {
+		joy_histogram_add(&latency->dispatch, done - ev->rtime);
+		joy_histogram_add(&latency->total, done - ev->time);
+	}
+}
+
+/* Show a batch of events, as the backend produced it, to whoever is
+ * interested (i.e., a JoyRecorder). Called from the thread that reads
+ * from the device. */
+static void joy_stick_tap(JoyStick* self, const JoyEvent* evs, gsize count) {
+	if(!g_atomic_pointer_get(&self->priv->tap)) {
+		return;
+	}
+	g_mutex_lock(&self->priv->taplock);
+	if(self->priv->tap) {
+		self->priv->tap(self->priv->tapdata, evs, count);
+	}
+	g_mutex_unlock(&self->priv->taplock);
+}
+
+/* Record a batch of events that was read from the device, and issue
+ * them unless we are in %JOY_MODE_POLL mode */
+static void joy_stick_process(JoyStick* self, JoyEvent* evs, gsize count) {
+	guint epoch = self->priv->epoch;
+
+	joy_stick_update_batch(self, evs, count);
+	joy_stick_tap(self, evs, count);
+	if(self->priv->mode != JOY_MODE_POLL) {
+		for(gsize i=0; i<count; i++) {
+			joy_stick_dispatch(self, &evs[i]);
+			if(self->priv->epoch != epoch) {
+				/* a handler closed the device, or changed how
+				 * it is read */
+				return;
+			}
+			if(self->priv->latency) {
+				joy_stick_measure(self, &evs[i], g_get_monotonic_time());
+			}
+		}
+	} else if(self->priv->latency) {
+		for(gsize i=0; i<count; i++) {
+			joy_stick_measure(self, &evs[i], 0);
+		}
+	}
+}
+
+static void joy_stick_alloc_buffers(JoyStick* self);
+
+static void joy_stick_busy_begin(JoyStick* self) {
+	self->priv->busy++;
+}
+
+/* The buffers are only resized once nothing uses them anymore */
+static void joy_stick_busy_end(JoyStick* self) {
+	if(--self->priv->busy == 0 && self->priv->newbatch) {
+		self->priv->batch = self->priv->newbatch;
+		self->priv->newbatch = 0;
+		joy_stick_alloc_buffers(self);
+	}
+}
+
+/* Translate records in the format of the backend into events, and
+ * record and issue them */
+static void joy_stick_process_records(JoyStick* self, const void* records, gsize count) {
+	gsize n;
+
+	joy_stick_busy_begin(self);
+	n = self->priv->backend->convert(self->priv->backend_data, self->priv->fd, records, count, self->priv->evbuf);
+	COUNTER_ADD(self->priv->nread, count);
+	JOY_TRACE_READ(self->priv->devname, count, n);
+	joy_stick_stamp(self, self->priv->evbuf, n);
+	joy_stick_process(self, self->priv->evbuf, n);
+	joy_stick_busy_end(self);
+}
+
+/* Read everything the driver has queued for us, one batch of events per
+ * read(), and dispatch it (or, in %JOY_MODE_POLL mode, only record it).
+ * Returns the number of records read, or -1 if the device went away. */
+static gssize joy_stick_drain(JoyStick* self) {
+	gsize bufsize = self->priv->batch * self->priv->backend->record_size;
+	guint epoch = self->priv->epoch;
+	gssize count = 0;
+	gssize rv;
+
+	joy_stick_busy_begin(self);
+	do {
+		gsize n;
+
+		rv = read(self->priv->fd, self->priv->rawbuf, bufsize);
+		self->priv->nreadcalls++;
+		if(rv < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno != EAGAIN) {
+				count = -1;
+			}
+			break;
+		}
+		if(rv == 0) {
+			count = -1;
+			break;
+		}
+		n = rv / self->priv->backend->record_size;
+		joy_stick_process_records(self, self->priv->rawbuf, n);
+		count += n;
+		/* If a handler closed the device or changed the mode, the
+		 * device may now be blocking, or read by someone else */
+		if(self->priv->epoch != epoch) {
+			break;
+		}
+		/* A short read means the driver's queue is empty */
+	} while(rv == (gssize)bufsize);
+	joy_stick_busy_end(self);
+	return count;
+}
+
+static gboolean handle_joystick_event(JoyStick* self, GIOCondition cond) {
+	gboolean alive = TRUE;
+
+	if(cond & G_IO_IN) {
+		alive = joy_stick_drain(self) >= 0;
+	} else if(cond & (G_IO_ERR | G_IO_HUP)) {
+		alive = FALSE;
+	}
+	if(!alive) {
+		joy_stick_disconnect(self);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean joy_stick_source_dispatch(GSource* source, GSourceFunc callback G_GNUC_UNUSED, gpointer user_data G_GNUC_UNUSED) {
+	JoyStickSource* jsource = (JoyStickSource*)source;
+	JoyStick* self = jsource->stick;
+	gboolean rv;
+
+	/* A handler may drop the last reference to the stick */
+	g_object_ref(self);
+	rv = handle_joystick_event(self, g_source_query_unix_fd(source, jsource->tag));
+	g_object_unref(self);
+	return rv;
+}
+
+static GSourceFuncs joy_stick_source_funcs = {
+	NULL,	/* prepare */
+	NULL,	/* check */
+	joy_stick_source_dispatch,
+	NULL,	/* finalize */
+};
+
+static gboolean joy_stick_flush_dispatch(GSource* source, GSourceFunc callback G_GNUC_UNUSED, gpointer user_data G_GNUC_UNUSED) {
+	JoyStick* self = ((JoyStickSource*)source)->stick;
+
+	g_object_ref(self);
+	joy_stick_flush_axes(self);
+	g_object_unref(self);
+	return TRUE;
+}
+
+static GSourceFuncs joy_stick_flush_funcs = {
+	NULL,	/* prepare */
+	NULL,	/* check */
+	joy_stick_flush_dispatch,
+	NULL,	/* finalize */
+};
+
+static void joy_stick_set_blocking(JoyStick* self, gboolean blocking) {
+	int flags = fcntl(self->priv->fd, F_GETFL);
+	if(flags < 0) {
+		return;
+	}
+	if(blocking) {
+		flags &= ~O_NONBLOCK;
+	} else {
+		flags |= O_NONBLOCK;
+	}
+	fcntl(self->priv->fd, F_SETFL, flags);
+}
+
+static void joy_stick_attach_flush(JoyStick* self) {
+	if(self->priv->flush) {
+		return;
+	}
+	self->priv->flush = g_source_new(&joy_stick_flush_funcs, sizeof(JoyStickSource));
+	((JoyStickSource*)self->priv->flush)->stick = self;
+	g_source_set_name(self->priv->flush, "JoyStick axis flush");
+	g_source_set_ready_time(self->priv->flush, self->priv->next_flush);
+	g_source_attach(self->priv->flush, self->priv->context);
+}
+
+static void joy_stick_attach_source(JoyStick* self) {
+	JoyStickSource* jsource;
+
+	self->priv->source = g_source_new(&joy_stick_source_funcs, sizeof(JoyStickSource));
+	jsource = (JoyStickSource*)self->priv->source;
+	jsource->stick = self;
+	jsource->tag = g_source_add_unix_fd(self->priv->source, self->priv->fd, G_IO_IN | G_IO_ERR | G_IO_HUP);
+	g_source_set_name(self->priv->source, "JoyStick");
+	g_source_attach(self->priv->source, self->priv->context);
+}
+
+static void joy_stick_destroy_source(GSource** source) {
+	if(!*source) {
+		return;
+	}
+	g_source_destroy(*source);
+	g_source_unref(*source);
+	*source = NULL;
+}
+
+/* Push a batch of events into the ring. Called on the reader thread
+ * only. Events that do not fit are dropped and counted. */
+static void joy_ring_push(JoyRing* ring, JoyEvent* evs, gsize count) {
+	gint head = ring->head;
+	gint tail = g_atomic_int_get(&ring->tail);
+
+	for(gsize i=0; i<count; i++) {
+		if(head - tail == RING_SIZE) {
+			tail = g_atomic_int_get(&ring->tail);
+			if(head - tail == RING_SIZE) {
+				g_atomic_int_inc(&ring->overflows);
+				continue;
+			}
+		}
+		ring->evs[head & (RING_SIZE - 1)] = evs[i];
+		head++;
+	}
+	g_atomic_int_set(&ring->head, head);
+}
+
+static void joy_stick_thread_setup(JoyStick* self) {
+	if(self->priv->thread_prio > 0) {
+		struct sched_param param = { .sched_priority = self->priv->thread_prio };
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(err) {
+			g_warning("Could not set SCHED_FIFO priority %d for %s: %s", self->priv->thread_prio, self->priv->devname, g_strerror(err));
+		}
+	}
+	if(self->priv->thread_cpu >= 0) {
+		cpu_set_t set;
+		int err;
+
+		CPU_ZERO(&set);
+		CPU_SET(self->priv->thread_cpu, &set);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(err) {
+			g_warning("Could not bind reader thread for %s to CPU %d: %s", self->priv->devname, self->priv->thread_cpu, g_strerror(err));
+		}
+	}
+}
+
+static gpointer joy_stick_reader(gpointer data) {
+	JoyStick* self = JOY_STICK(data);
+	JoyRing* ring = self->priv->ring;
+	const JoyBackend* backend = self->priv->backend;
+	gsize bufsize = self->priv->batch * backend->record_size;
+	guchar* buf = g_malloc(bufsize);
+	JoyEvent* evs = g_new(JoyEvent, JOY_BACKEND_MAX_EVENTS(self->priv->batch));
+	struct pollfd pfd[2] = {
+		{ .fd = self->priv->fd, .events = POLLIN },
+		{ .fd = self->priv->wake[0], .events = POLLIN },
+	};
+
+	joy_stick_thread_setup(self);
+	while(TRUE) {
+		gssize rv;
+		gsize count;
+
+		if(poll(pfd, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if(pfd[1].revents) {
+			/* asked to stop */
+			g_free(buf);
+			g_free(evs);
+			return NULL;
+		}
+		if(pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			break;
+		}
+		do {
+			rv = read(self->priv->fd, buf, bufsize);
+			COUNTER_ADD(self->priv->nreadcalls, 1);
+		} while(rv < 0 && errno == EINTR);
+		if(rv < 0 && errno == EAGAIN) {
+			continue;
+		}
+		if(rv <= 0) {
+			break;
+		}
+		/* Record the state here rather than on the main context, so that
+		 * joy_stick_snapshot() is not held up by it */
+		count = backend->convert(self->priv->backend_data, self->priv->fd, buf, rv / backend->record_size, evs);
+		COUNTER_ADD(self->priv->nread, rv / backend->record_size);
+		JOY_TRACE_READ(self->priv->devname, rv / backend->record_size, count);
+		joy_stick_stamp(self, evs, count);
+		joy_stick_update_batch(self, evs, count);
+		joy_stick_tap(self, evs, count);
+		joy_ring_push(ring, evs, count);
+		if(g_atomic_int_compare_and_exchange(&ring->notify, 0, 1)) {
+			g_main_context_wakeup(self->priv->context);
+		}
+	}
+	g_free(buf);
+	g_free(evs);
+	g_atomic_int_set(&ring->hangup, 1);
+	g_main_context_wakeup(self->priv->context);
+	return NULL;
+}
+
+static gboolean joy_stick_ring_pending(JoyRing* ring) {
+	return g_atomic_int_get(&ring->head) != ring->tail || g_atomic_int_get(&ring->hangup);
+}
+
+static gboolean joy_stick_ring_prepare(GSource* source, gint* timeout) {
+	*timeout = -1;
+	return joy_stick_ring_pending(((JoyStickSource*)source)->stick->priv->ring);
+}
+
+static gboolean joy_stick_ring_check(GSource* source) {
+	return joy_stick_ring_pending(((JoyStickSource*)source)->stick->priv->ring);
+}
+
+static gboolean joy_stick_ring_dispatch(GSource* source, GSourceFunc callback G_GNUC_UNUSED, gpointer user_data G_GNUC_UNUSED) {
+	JoyStick* self = ((JoyStickSource*)source)->stick;
+	JoyRing* ring = self->priv->ring;
+	guint epoch = self->priv->epoch;
+	guint overflows;
+	gint head;
+
+	g_object_ref(self);
+	g_atomic_int_set(&ring->notify, 0);
+	head = g_atomic_int_get(&ring->head);
+	while(ring->tail != head) {
+		JoyEvent ev = ring->evs[ring->tail & (RING_SIZE - 1)];
+		g_atomic_int_set(&ring->tail, ring->tail + 1);
+		joy_stick_dispatch(self, &ev);
+		if(self->priv->latency) {
+			joy_stick_measure(self, &ev, g_get_monotonic_time());
+		}
+		/* The ring may have been freed and another one allocated at
+		 * the same address, so its address proves nothing */
+		if(self->priv->epoch != epoch) {
+			/* a handler changed the mode, or dropped the device */
+			g_object_unref(self);
+			return FALSE;
+		}
+	}
+	overflows = g_atomic_int_get(&ring->overflows);
+	if(overflows != self->priv->overflows) {
+		g_warning("%s: %u events were lost because the reader thread's buffer was full", self->priv->devname, overflows - self->priv->overflows);
+		self->priv->overflows = overflows;
+		g_object_notify_by_pspec(G_OBJECT(self), props[JOY_OVERFLOWS]);
+	}
+	if(g_atomic_int_get(&ring->hangup) && g_atomic_int_get(&ring->head) == ring->tail) {
+		joy_stick_disconnect(self);
+		g_object_unref(self);
+		return FALSE;
+	}
+	g_object_unref(self);
+	return TRUE;
+}
+
+static GSourceFuncs joy_stick_ring_funcs = {
+	joy_stick_ring_prepare,
+	joy_stick_ring_check,
+	joy_stick_ring_dispatch,
+	NULL,	/* finalize */
+};
+
+static void joy_stick_start_thread(JoyStick* self) {
+	GError* err = NULL;
+
+	if(!g_unix_open_pipe(self->priv->wake, FD_CLOEXEC, &err)) {
+		g_warning("Could not start reader thread for %s: %s", self->priv->devname, err->message);
+		g_error_free(err);
+		return;
+	}
+	self->priv->ring = g_new0(JoyRing, 1);
+	if(self->priv->thread_mlock && mlock(self->priv->ring, sizeof(JoyRing)) < 0) {
+		g_warning("Could not lock the event buffer of %s in memory: %s", self->priv->devname, g_strerror(errno));
+	}
+	self->priv->ringsrc = g_source_new(&joy_stick_ring_funcs, sizeof(JoyStickSource));
+	((JoyStickSource*)self->priv->ringsrc)->stick = self;
+	g_source_set_name(self->priv->ringsrc, "JoyStick reader thread");
+	g_source_attach(self->priv->ringsrc, self->priv->context);
+	self->priv->thread = g_thread_new("joy-reader", joy_stick_reader, self);
+}
+
+static void joy_stick_stop_thread(JoyStick* self) {
+	if(!self->priv->thread) {
+		return;
+	}
+	if(write(self->priv->wake[1], "", 1) < 0) {
+		g_warning("Could not stop reader thread for %s: %s", self->priv->devname, g_strerror(errno));
+	}
+	g_thread_join(self->priv->thread);
+	self->priv->thread = NULL;
+	close(self->priv->wake[0]);
+	close(self->priv->wake[1]);
+	joy_stick_destroy_source(&self->priv->ringsrc);
+	if(self->priv->thread_mlock) {
+		munlock(self->priv->ring, sizeof(JoyRing));
+	}
+	g_free(self->priv->ring);
+	self->priv->ring = NULL;
+}
+
+/* Start issuing events in the way the current mode requires */
+static void joy_stick_start(JoyStick* self) {
+	if(self->priv->fd < 0) {
+		return;
+	}
+	if(self->priv->hub) {
+		/* The hub reads from the device; we only need to flush
+		 * coalesced axis events */
+		joy_stick_set_blocking(self, FALSE);
+		joy_stick_attach_flush(self);
+		return;
+	}
+	switch(self->priv->mode) {
+		case JOY_MODE_MAINLOOP:
+			joy_stick_set_blocking(self, FALSE);
+			joy_stick_attach_source(self);
+			joy_stick_attach_flush(self);
+			break;
+		case JOY_MODE_THREAD:
+			joy_stick_set_blocking(self, FALSE);
+			joy_stick_start_thread(self);
+			joy_stick_attach_flush(self);
+			break;
+		case JOY_MODE_POLL:
+			joy_stick_set_blocking(self, FALSE);
+			break;
+		default:
+			break;
+	}
+}
+
+static void joy_stick_stop(JoyStick* self) {
+	self->priv->epoch++;
+	joy_stick_destroy_source(&self->priv->source);
+	joy_stick_stop_thread(self);
+	joy_stick_destroy_source(&self->priv->flush);
+	if(self->priv->fd >= 0) {
+		joy_stick_set_blocking(self, TRUE);
+	}
+}
+
+int _joy_stick_get_fd(JoyStick* self) {
+	return self->priv->fd;
+}
+
+gboolean _joy_stick_handle_events(JoyStick* self, GIOCondition cond) {
+	return handle_joystick_event(self, cond);
+}
+
+void _joy_stick_process_records(JoyStick* self, const void* records, gsize size) {
+	const guchar* p = records;
+	gsize count = size / self->priv->backend->record_size;
+	guint epoch = self->priv->epoch;
+
+	/* evbuf only has room for one batch */
+	joy_stick_busy_begin(self);
+	while(count > 0 && self->priv->epoch == epoch) {
+		gsize n = MIN(count, self->priv->batch);
+
+		joy_stick_process_records(self, p, n);
+		p += n * self->priv->backend->record_size;
+		count -= n;
+	}
+	joy_stick_busy_end(self);
+}
+
+gboolean _joy_stick_set_tap(JoyStick* self, JoyStickTap tap, gpointer data, gint32* axes, guint64* buttons) {
+	gboolean rv = TRUE;
+
+	g_mutex_lock(&self->priv->taplock);
+	if(tap && self->priv->tap) {
+		rv = FALSE;
+	} else {
+		self->priv->tapdata = data;
+		g_atomic_pointer_set(&self->priv->tap, tap);
+		/* A batch is tapped after it was recorded in the state, so
+		 * anything that is missing from the snapshot is passed to
+		 * the tap; at worst, a batch is in both */
+		if(axes && buttons) {
+			JoyStickState state;
+
+			joy_stick_snapshot(self, &state);
+			memcpy(axes, state.axes, sizeof(state.axes));
+			memcpy(buttons, state.buttons, sizeof(state.buttons));
+		}
+	}
+	g_mutex_unlock(&self->priv->taplock);
+	return rv;
+}
+
+void _joy_stick_set_hub(JoyStick* self, gpointer hub) {
+	joy_stick_stop(self);
+	self->priv->hub = hub;
+	joy_stick_start(self);
+}
+
+static void joy_stick_apply_grab(JoyStick* self) {
+	if(!self->priv->backend->grab) {
+		g_warning("%s: the %s interface does not support grabbing the device", self->priv->devname, self->priv->backend->name);
+		return;
+	}
+	if(!self->priv->backend->grab(self->priv->backend_data, self->priv->fd, self->priv->grab)) {
+		g_warning("Could not %s %s: %s", self->priv->grab ? "grab" : "release", self->priv->devname, g_strerror(errno));
+	}
+}
+
+/* The backends to try, in order. Those with a prefix only get the
+ * device nodes that match it; of the others, the last one accepts
+ * anything. */
+static const JoyBackend* backends[] = {
+	&_joy_backend_virtual,
+	&_joy_backend_replay,
+	&_joy_backend_evdev,
+	&_joy_backend_joydev,
+};
+
+/* Open the device node, and find out what it is. Does not touch any
+ * JoyStick, so may be called from any thread. On failure, probe->fd is
+ * -1. */
+static gboolean joy_probe_open(JoyProbe* probe) {
+	int fd = -1;
+
+	probe->fd = -1;
+	for(guint i=0; i<G_N_ELEMENTS(backends); i++) {
+		const JoyBackend* backend = backends[i];
+		gpointer data = NULL;
+
+		if(backend->prefix) {
+			if(!g_str_has_prefix(probe->devname, backend->prefix)) {
+				continue;
+			}
+			fd = backend->open(probe->devname, &data);
+			if(fd < 0) {
+				return FALSE;
+			}
+		} else if(fd < 0) {
+			fd = open(probe->devname, O_RDONLY);
+			if(fd < 0) {
+				return FALSE;
+			}
+		}
+		memset(&probe->info, 0, sizeof(probe->info));
+		if(backend->probe(fd, &probe->info, &data)) {
+			probe->fd = fd;
+			probe->backend = backend;
+			probe->data = data;
+			return TRUE;
+		}
+		if(backend->free && data) {
+			backend->free(data);
+		}
+		if(backend->prefix) {
+			break;
+		}
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
+	return FALSE;
+}
+
+/* Throw away a device that was opened, but is not going to be used */
+static void joy_probe_discard(JoyProbe* probe) {
+	if(probe->fd < 0) {
+		return;
+	}
+	close(probe->fd);
+	probe->fd = -1;
+	if(probe->backend->free && probe->data) {
+		probe->backend->free(probe->data);
+	}
+	probe->data = NULL;
+}
 
-#include <joy/joystick.h>
-#include <joy-marshallers.h>
+/* Close the device (if it still is open), and forget everything we knew
+ * about it */
+static void joy_stick_close(JoyStick* self) {
+	self->priv->epoch++;
+	if(self->priv->fd >= 0) {
+		joy_stick_stop(self);
+		close(self->priv->fd);
+		self->priv->fd = -1;
+	}
+	if(self->priv->backend && self->priv->backend->free) {
+		self->priv->backend->free(self->priv->backend_data);
+	}
+	self->priv->backend_data = NULL;
+	g_clear_pointer(&self->priv->axes, g_free);
+	g_clear_pointer(&self->priv->axmap, g_free);
+	g_clear_pointer(&self->priv->butmap, g_free);
+	g_clear_pointer(&self->priv->axmin, g_free);
+	g_clear_pointer(&self->priv->axmax, g_free);
+	self->priv->naxes = self->priv->nbuts = 0;
+}
 
-/* These two were shamelessly stolen from jstest.c */
-char* axis_names[ABS_MAX + 1] = {
-"X", "Y", "Z", "Rx", "Ry", "Rz", "Throttle", "Rudder", 
-"Wheel", "Gas", "Brake", "?", "?", "?", "?", "?",
-"Hat0X", "Hat0Y", "Hat1X", "Hat1Y", "Hat2X", "Hat2Y", "Hat3X", "Hat3Y",
-"?", "?", "?", "?", "?", "?", "?", 
-};
+static void joy_stick_alloc_buffers(JoyStick* self) {
+	if(self->priv->busy) {
+		if(!self->priv->newbatch) {
+			self->priv->newbatch = self->priv->batch;
+		}
+		return;
+	}
+	self->priv->rawbuf = g_realloc(self->priv->rawbuf, self->priv->batch * self->priv->backend->record_size);
+	self->priv->evbuf = g_renew(JoyEvent, self->priv->evbuf, JOY_BACKEND_MAX_EVENTS(self->priv->batch));
+}
 
-char* button_names[KEY_MAX - BTN_MISC + 1] = {
-"Btn0", "Btn1", "Btn2", "Btn3", "Btn4", "Btn5", "Btn6", "Btn7", "Btn8", "Btn9", "?", "?", "?", "?", "?", "?",
-"LeftBtn", "RightBtn", "MiddleBtn", "SideBtn", "ExtraBtn", "ForwardBtn", "BackBtn", "TaskBtn", "?", "?", "?", "?", "?", "?", "?", "?",
-"Trigger", "ThumbBtn", "ThumbBtn2", "TopBtn", "TopBtn2", "PinkieBtn", "BaseBtn", "BaseBtn2", "BaseBtn3", "BaseBtn4", "BaseBtn5", "BaseBtn6", "BtnDead",
-"BtnA", "BtnB", "BtnC", "BtnX", "BtnY", "BtnZ", "BtnTL", "BtnTR", "BtnTL2", "BtnTR2", "BtnSelect", "BtnStart", "BtnMode", "BtnThumbL", "BtnThumbR", "?",
-"?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", 
-"WheelBtn", "Gear up",
-};
+static void joy_stick_apply_info(JoyStick* self, const JoyDeviceInfo* info);
 
-/**
-  * SECTION:joystick
-  * @short_description: a joystick interface
-  * @see_also: #JoyModel
-  * @stability: Unstable
-  * @include: joy/joystick.h
-  */
+/* Take over a device that was opened by joy_probe_open() */
+static void joy_stick_adopt(JoyStick* self, JoyProbe* probe) {
+	self->priv->fd = probe->fd;
+	self->priv->backend = probe->backend;
+	self->priv->backend_data = probe->data;
+	probe->fd = -1;
+	probe->data = NULL;
+	JOY_TRACE_REOPEN(self->priv->devname, self->priv->fd, self->priv->backend->name);
+	joy_stick_apply_info(self, &probe->info);
+	joy_stick_alloc_buffers(self);
+	if(self->priv->grab) {
+		joy_stick_apply_grab(self);
+	}
+	if(self->priv->hub) {
+		_joy_hub_update_fd(self->priv->hub, self);
+	}
+	joy_stick_start(self);
+	self->priv->ready = TRUE;
+}
 
-#define NAME_LEN 128
+static gboolean joy_stick_reopen(JoyStick* self) {
+	JoyProbe probe;
 
-static GHashTable* object_index = NULL;
+	self->priv->ready = FALSE;
+	joy_stick_close(self);
+	if(!self->priv->devname) {
+		self->priv->fd = -1;
+		return FALSE;
+	}
+	probe.devname = self->priv->devname;
+	if(!joy_probe_open(&probe)) {
+		return FALSE;
+	}
+	joy_stick_adopt(self, &probe);
+	return TRUE;
+}
 
-struct _JoyStickPrivate {
-	int fd;
-	gboolean ready;
-	uint8_t axmap[ABS_MAX + 1];
-	uint16_t butmap[KEY_MAX - BTN_MISC + 1];
-	uint8_t nbuts;
-	uint8_t naxes;
-	GArray* butvals;
-	GArray* axvals;
-	GArray* axevts;
-	guint axintv;
-	gchar name[NAME_LEN];
-	gchar* devname;
-	JoyMode mode;
-	guint watch;
-};
+/* Like joy_stick_open(), for a device that was opened already. Returns
+ * the existing object if there is one; in that case, or if the device
+ * could not be opened, the JoyStick is not open. */
+static JoyStick* joy_stick_open_probed(JoyProbe* probe) {
+	JoyStick* js;
 
-enum {
-	JOY_OPEN = 1,
-	JOY_BUTCNT,
-	JOY_AXCNT,
-	JOY_NAME,
-	JOY_DEVNAME,
-	JOY_INTV,
-	JOY_PROP_COUNT,
-};
+	if(object_index && g_hash_table_contains(object_index, probe->devname)) {
+		joy_probe_discard(probe);
+		return joy_stick_open(probe->devname);
+	}
+	js = g_object_new(JOY_TYPE_STICK, "devnode", NULL, NULL);
+	js->priv->devname = g_strdup(probe->devname);
+	if(probe->fd >= 0) {
+		joy_stick_adopt(js, probe);
+	}
+	g_hash_table_insert(object_index, js->priv->devname, js);
+	JOY_TRACE_OPEN(js->priv->devname);
+	return js;
+}
 
-static GParamSpec *props[JOY_PROP_COUNT] = { NULL, };
+/* A name for the device behind @dev that survives unplugging it and
+ * plugging it in again: its serial number if it has one, or otherwise
+ * the port it is plugged into. The kind of device node is added, since a
+ * joystick has a node for every interface. NULL if udev knows neither. */
+gchar* _joy_device_identity(struct udev_device* dev) {
+	const char* sysname = udev_device_get_sysname(dev);
+	const char* id = NULL;
 
-/** 
-  * joy_stick_open: (constructor)
-  * @devname: the device node of the joystick to open
-  * 
-  * This function creates a new #JoyStick object.
-  *
-  * Warning: this function always returns a #JoyStick; but if the
-  * device node cannot be opened for some reason, then it will not issue
-  * any events. Use the #JoyStick:open property to verify that
-  * it can do anything useful.
-  *
-  * Returns: a newly-allocated #JoyStick.
-  */
-JoyStick* joy_stick_open(const gchar* devname) {
-	JoyStick* js;
-	if(!object_index || !g_hash_table_contains(object_index, devname)) {
-		js = g_object_new(JOY_TYPE_STICK, "devnode", devname, NULL);
-		/* Since it's base_init which creates our hash table, it might
-		 * not actually exist until the above returns */
-		g_hash_table_insert(object_index, (gchar*)devname, js);
-	} else {
-		js = JOY_STICK(g_hash_table_lookup(object_index, devname));
-		g_object_ref(G_OBJECT(js));
+	if(udev_device_get_property_value(dev, "ID_SERIAL_SHORT")) {
+		id = udev_device_get_property_value(dev, "ID_SERIAL");
 	}
-	return js;
+	if(!id) {
+		id = udev_device_get_property_value(dev, "ID_PATH");
+	}
+	if(!id || !sysname) {
+		return NULL;
+	}
+	return g_strdup_printf("%s/%.*s", id, (int)strcspn(sysname, "0123456789"), sysname);
 }
 
-/** 
-  * joy_stick_enum_free: (skip)
-  * @enumeration: the enumeration to free.
-  *
-  * Free the return value of joy_stick_enumerate(). This is a
-  * convenience function; it simply calls g_object_unref() on each of
-  * the elements of the list, and frees the list nodes.
-  *
-  */
-void joy_stick_enum_free(GList* enumeration) {
-	while(enumeration) {
-		g_object_unref(JOY_STICK(enumeration->data));
-		GList* next = enumeration->next;
-		g_free(enumeration);
-		enumeration = next;
+static void joy_stick_forget_lost(JoyStick* self) {
+	if(self->priv->identity && g_hash_table_lookup(lost_index, self->priv->identity) == self) {
+		g_hash_table_remove(lost_index, self->priv->identity);
 	}
 }
 
-/** 
-  * joy_stick_enumerate:
-  *
-  * Enumerate all joystick device nodes on this system
-  *
-  * See also joy_stick_enum_free()
-  *
-  * Returns: (element-type Joy.Stick) (transfer full): a #GList of #JoyStick
-  * objects, or %NULL in case of error
-  */
-GList* joy_stick_enumerate() {
-	GList* retval = NULL;
+/* Find out the identity of the device that is open now, if the
+ * joystick is persistent; only kernel devices have one */
+static void joy_stick_update_identity(JoyStick* self) {
 	struct udev* udev;
-	struct udev_enumerate *enumer;
-	struct udev_list_entry *devices, *dev_list_entry;
-	struct udev_device *dev;
-	JoyStick *joy;
+	struct udev_device* dev;
+	struct stat st;
 
+	joy_stick_forget_lost(self);
+	g_clear_pointer(&self->priv->identity, g_free);
+	if(!self->priv->persistent || self->priv->fd < 0 || self->priv->backend->prefix) {
+		return;
+	}
+	if(fstat(self->priv->fd, &st) < 0 || !S_ISCHR(st.st_mode)) {
+		return;
+	}
 	udev = udev_new();
 	if(!udev) {
+		return;
+	}
+	dev = udev_device_new_from_devnum(udev, 'c', st.st_rdev);
+	if(dev) {
+		self->priv->identity = _joy_device_identity(dev);
+		udev_device_unref(dev);
+	}
+	udev_unref(udev);
+}
+
+JoyStick* _joy_stick_lookup_lost(const gchar* identity) {
+	if(!lost_index) {
 		return NULL;
 	}
+	return g_hash_table_lookup(lost_index, identity);
+}
 
-	enumer = udev_enumerate_new(udev);
-	udev_enumerate_add_match_subsystem(enumer, "input");
-	udev_enumerate_scan_devices(enumer);
-	devices = udev_enumerate_get_list_entry(enumer);
-	udev_list_entry_foreach(dev_list_entry, devices) {
-		const char* path = udev_list_entry_get_name(dev_list_entry);
-		dev = udev_device_new_from_syspath(udev, path);
-		const char* name = udev_device_get_sysname(dev);
-		char* devnode = g_strdup(udev_device_get_devnode(dev));
-		if(name[0] == 'j' && name[1] == 's') {
-			joy = joy_stick_open(devnode);
-			retval = g_list_append(retval, joy);
+/* Issue the state that joy_stick_apply_info() took from the backend as
+ * signals, just like joydev's state dump: the axes that are not at 0 and
+ * the buttons that are pressed, and a report */
+static void joy_stick_issue_initial(JoyStick* self) {
+	JoyValues* report = self->priv->report;
+	gint64 now = g_get_monotonic_time();
+	guint epoch = self->priv->epoch;
+	JoyEvent ev;
+
+	if(self->priv->mode == JOY_MODE_POLL) {
+		return;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.time = now;
+	ev.flags = JOY_EVENT_INIT;
+	ev.type = JOY_EVENT_BUTTON;
+	ev.value = 1;
+	for(guint i=0; i<report->n_buttons && epoch == self->priv->epoch; i++) {
+		if(report->words[i / 64] & (G_GUINT64_CONSTANT(1) << (i % 64))) {
+			ev.number = i;
+			joy_stick_dispatch(self, &ev);
 		}
 	}
-	return retval;
+	for(guint i=0; i<report->n_axes && epoch == self->priv->epoch; i++) {
+		if(self->priv->axes[i].value) {
+			joy_values_changed(report)[0] |= G_GUINT64_CONSTANT(1) << i;
+			self->priv->axes[i].time = now;
+			joy_stick_emit_axis(self, i, &self->priv->axes[i], now);
+		}
+	}
+	if(epoch == self->priv->epoch) {
+		ev.type = JOY_EVENT_SYNC;
+		ev.number = 0;
+		ev.value = 0;
+		joy_stick_dispatch(self, &ev);
+	}
 }
 
-/** 
-  * joy_stick_describe_unopened:
-  * @devname: the path of the joystick device node to describe.
-  *
-  * Describe a joystick without first calling joy_stick_open().
-  *
-  * Note that to get the requested information, this function will open
-  * the joystick device, perform the correct ioctl() to retrieve the
-  * requested data, and close the device again; so this function is no
-  * substitute for when joy_stick_open() followed by
-  * joy_stick_describe() fails for some reason (e.g., permission issues)
-  *
-  * Returns: (transfer full): the identity string of the joystick, or %NULL in
-  * case of error (with @err set appropriately)
-  */
-gchar* joy_stick_describe_unopened(gchar* devname) {
-	JoyStick* joy = joy_stick_open(devname);
-	gchar* retval = g_strdup(joy_stick_describe(joy));
-	g_object_unref(joy);
-	return retval;
-}
+/* Bind a persistent joystick that was disconnected to @devnode, where its
+ * device reappeared; @appeared is when that happened, on the clock of
+ * g_get_monotonic_time(). Everything that was set on the JoyStick is
+ * kept, including the settings of single axes if the layout of the device
+ * did not change. */
+gboolean _joy_stick_rebind(JoyStick* self, const gchar* devnode, gint64 appeared) {
+	JoyProbe probe;
+	JoyAxis* axes;
+	uint8_t* axmap;
+	guint8 naxes;
+	gboolean renamed;
 
-static gboolean handle_joystick_event(gint fd, GIOCondition cond, gpointer user_data) {
-	JoyStick* self = JOY_STICK(user_data);
-	if(cond & G_IO_IN) {
-		joy_stick_iteration(self);
-	} else {
-		g_hash_table_remove(object_index, self->priv->devname);
-		close(self->priv->fd);
-		g_signal_emit(self, JOY_STICK_GET_CLASS(self)->disconnected, 0, NULL);
-		self->priv->ready = FALSE;
+	if(self->priv->fd >= 0 || self->priv->context != g_main_context_default()) {
+		return FALSE;
+	}
+	if(g_hash_table_contains(object_index, devnode)) {
 		return FALSE;
 	}
+	probe.devname = devnode;
+	if(!joy_probe_open(&probe)) {
+		return FALSE;
+	}
+	joy_stick_forget_lost(self);
+	naxes = self->priv->naxes;
+	axes = g_steal_pointer(&self->priv->axes);
+	axmap = g_steal_pointer(&self->priv->axmap);
+	joy_stick_close(self);
+	renamed = g_strcmp0(self->priv->devname, devnode) != 0;
+	if(renamed) {
+		g_free(self->priv->devname);
+		self->priv->devname = g_strdup(devnode);
+	}
+	g_hash_table_insert(object_index, self->priv->devname, self);
+	joy_stick_adopt(self, &probe);
+	if(axes && naxes == self->priv->naxes && !memcmp(axmap, self->priv->axmap, naxes)) {
+		for(guint i=0; i<naxes; i++) {
+			self->priv->axes[i].intv = axes[i].intv;
+			self->priv->axes[i].thresh = axes[i].thresh;
+		}
+	}
+	g_free(axes);
+	g_free(axmap);
+	self->priv->reconnect_latency = g_get_monotonic_time() - appeared;
+	JOY_TRACE_RECONNECT(self->priv->devname, self->priv->reconnect_latency);
+
+	g_object_ref(self);
+	if(renamed) {
+		g_object_notify_by_pspec(G_OBJECT(self), props[JOY_DEVNAME]);
+	}
+	g_object_notify_by_pspec(G_OBJECT(self), props[JOY_RECONNECT_LATENCY]);
+	g_signal_emit(self, JOY_STICK_GET_CLASS(self)->reconnected, 0, NULL);
+	/* unless a handler closed it again */
+	if(self->priv->fd >= 0) {
+		joy_stick_issue_initial(self);
+	}
+	g_object_unref(self);
 	return TRUE;
 }
 
-static gboolean joy_stick_reopen(JoyStick* self) {
-	self->priv->ready = FALSE;
-	if(self->priv->fd >= 0) {
-		close(self->priv->fd);
-		g_array_set_size(self->priv->butvals, 0);
-		g_array_set_size(self->priv->axvals, 0);
-		g_array_set_size(self->priv->axevts, 0);
+/* Set up a blank state and report for the given layout, in one block; the
+ * report starts on a cache line of its own, since in %JOY_MODE_THREAD mode
+ * the state is written by the thread that reads the device and the report
+ * by the thread that issues the signals. joy_stick_snapshot() may be
+ * reading the old block from another thread, so when the layout changes
+ * it is kept until the #JoyStick is finalized. */
+static void joy_stick_alloc_values(JoyStick* self, guint8 naxes, guint8 nbuts) {
+	JoyValues* old = self->priv->state;
+	guint8 nwords = (nbuts + 63) / 64;
+	gsize ssize = sizeof(JoyValues) + (nwords + (naxes + 1) / 2) * sizeof(guint64);
+	gsize roff = (ssize + CACHE_LINE - 1) & ~(gsize)(CACHE_LINE - 1);
+	gsize size = roff + ssize + (nwords + 1) * sizeof(guint64);
+	gpointer block = old;
+
+	joy_stick_state_begin(self);
+	if(old && old->n_axes == naxes && old->n_buttons == nbuts) {
+		memset(old->words, 0, ssize - sizeof(JoyValues));
+		old->time = 0;
+	} else {
+		if(posix_memalign(&block, CACHE_LINE, size) != 0) {
+			g_error("Could not allocate %" G_GSIZE_FORMAT " bytes", size);
+		}
+		memset(block, 0, size);
+		self->priv->report = (JoyValues*)((guchar*)block + roff);
+		self->priv->report->n_axes = ((JoyValues*)block)->n_axes = naxes;
+		self->priv->report->n_buttons = ((JoyValues*)block)->n_buttons = nbuts;
+		self->priv->report->n_words = ((JoyValues*)block)->n_words = nwords;
+		g_atomic_pointer_set(&self->priv->state, block);
+		if(old) {
+			self->priv->retired = g_slist_prepend(self->priv->retired, old);
+		}
 	}
-	if(!self->priv->devname) {
-		self->priv->fd = -1;
-		return FALSE;
+	joy_stick_state_end(self);
+	memset(self->priv->report->words, 0, size - roff - sizeof(JoyValues));
+	self->priv->report->time = 0;
+	memset(self->priv->repout, 0, sizeof(JoyStickReport));
+	self->priv->repout->n_axes = naxes;
+	self->priv->repout->n_buttons = nbuts;
+}
+
+/* Take over the layout of the device, and start from a blank state */
+static void joy_stick_apply_info(JoyStick* self, const JoyDeviceInfo* info) {
+	self->priv->epoch++;
+	g_clear_pointer(&self->priv->axes, g_free);
+	g_clear_pointer(&self->priv->axmap, g_free);
+	g_clear_pointer(&self->priv->butmap, g_free);
+	g_clear_pointer(&self->priv->axmin, g_free);
+	g_clear_pointer(&self->priv->axmax, g_free);
+	self->priv->naxes = info->naxes;
+	self->priv->nbuts = info->nbuts;
+	self->priv->axmap = g_new(uint8_t, self->priv->naxes);
+	memcpy(self->priv->axmap, info->axmap, self->priv->naxes * sizeof(uint8_t));
+	self->priv->butmap = g_new(uint16_t, self->priv->nbuts);
+	memcpy(self->priv->butmap, info->butmap, self->priv->nbuts * sizeof(uint16_t));
+	self->priv->axmin = g_new(gint32, self->priv->naxes);
+	memcpy(self->priv->axmin, info->axmin, self->priv->naxes * sizeof(gint32));
+	self->priv->axmax = g_new(gint32, self->priv->naxes);
+	memcpy(self->priv->axmax, info->axmax, self->priv->naxes * sizeof(gint32));
+	self->priv->axes = g_new0(JoyAxis, self->priv->naxes);
+	for(guint i=0; i<self->priv->naxes; i++) {
+		self->priv->axes[i].intv = self->priv->axintv;
+		self->priv->axes[i].thresh = self->priv->axthresh;
 	}
-	self->priv->fd = open(self->priv->devname, O_RDONLY);
-	if(self->priv->fd < 0) {
-		return FALSE;
+	memcpy(self->priv->name, info->name, sizeof(self->priv->name));
+	self->priv->name[JOY_NAME_LEN - 1] = '\0';
+	joy_stick_alloc_values(self, self->priv->naxes, self->priv->nbuts);
+	/* Start from the state the backend found, if any, as if it had
+	 * been issued already */
+	joy_stick_state_begin(self);
+	memcpy(self->priv->state->words, info->buttons, self->priv->state->n_words * sizeof(guint64));
+	memcpy(joy_values_axes(self->priv->state), info->axval, self->priv->naxes * sizeof(gint32));
+	joy_stick_state_end(self);
+	memcpy(self->priv->report->words, info->buttons, self->priv->report->n_words * sizeof(guint64));
+	memcpy(joy_values_axes(self->priv->report), info->axval, self->priv->naxes * sizeof(gint32));
+	for(guint i=0; i<self->priv->naxes; i++) {
+		self->priv->axes[i].value = self->priv->axes[i].emitted = info->axval[i];
 	}
-	ioctl(self->priv->fd, JSIOCGAXMAP, self->priv->axmap);
-	ioctl(self->priv->fd, JSIOCGBTNMAP, self->priv->butmap);
-	ioctl(self->priv->fd, JSIOCGAXES, &(self->priv->naxes));
-	g_array_set_size(self->priv->axvals, self->priv->naxes);
-	g_array_set_size(self->priv->axevts, self->priv->naxes);
-	ioctl(self->priv->fd, JSIOCGBUTTONS, &(self->priv->nbuts));
-	g_array_set_size(self->priv->butvals, self->priv->nbuts);
-	ioctl(self->priv->fd, JSIOCGNAME(NAME_LEN), self->priv->name);
-	self->priv->watch = g_unix_fd_add(self->priv->fd, G_IO_IN | G_IO_ERR | G_IO_HUP, handle_joystick_event, self);
-	self->priv->ready = TRUE;
-	return TRUE;
+	/* The state dump of a freshly opened device is not an overflow */
+	self->priv->changed = FALSE;
+	self->priv->resyncing = FALSE;
+}
+
+void _joy_stick_set_layout(JoyStick* self, guint8 naxes, guint8 nbuts) {
+	JoyDeviceInfo info;
+
+	g_return_if_fail(naxes <= JOY_STICK_MAX_AXES);
+	memset(&info, 0, sizeof(info));
+	info.naxes = naxes;
+	info.nbuts = nbuts;
+	for(guint i=0; i<naxes; i++) {
+		info.axmap[i] = i;
+		info.axmin[i] = -32767;
+		info.axmax[i] = 32767;
+	}
+	for(guint i=0; i<nbuts; i++) {
+		info.butmap[i] = BTN_MISC + i;
+	}
+	memcpy(info.name, self->priv->name, sizeof(info.name));
+	joy_stick_apply_info(self, &info);
 }
 
 /** 
@@ -329,9 +1998,36 @@ const gchar* joy_stick_get_devnode(JoyStick* self) {
   * (e.g., "Throttle" or "X")
   */
 const gchar* joy_stick_describe_axis(JoyStick* self, guint8 axis) {
+	g_return_val_if_fail(axis < self->priv->naxes, NULL);
 	return axis_names[self->priv->axmap[axis]];
 }
 
+/** 
+  * joy_stick_get_axis_range:
+  * @self: a #JoyStick
+  * @axis: the axis to look up
+  * @min: (out) (allow-none): return location for the minimum value, or %NULL
+  * @max: (out) (allow-none): return location for the maximum value, or %NULL
+  *
+  * Look up the range of the values of an axis. For devices that are opened
+  * through the legacy joystick interface (`/dev/input/js*`), this is always
+  * -32767 to 32767, as the kernel scales all values to that range; for
+  * devices that are opened through the evdev interface
+  * (`/dev/input/event*`), it is the native range of the hardware.
+  *
+  * Returns: %TRUE if @axis exists, %FALSE otherwise.
+  */
+gboolean joy_stick_get_axis_range(JoyStick* self, guchar axis, gint* min, gint* max) {
+	g_return_val_if_fail(axis < self->priv->naxes, FALSE);
+	if(min) {
+		*min = self->priv->axmin[axis];
+	}
+	if(max) {
+		*max = self->priv->axmax[axis];
+	}
+	return TRUE;
+}
+
 /** 
   * joy_stick_describe_button:
   * @self: a #JoyStick
@@ -399,6 +2095,7 @@ JoyBtnType joy_stick_get_button_type(JoyStick* self, guchar button) {
   * Returns: the type of the axis
   */
 JoyAxisType joy_stick_get_axis_type(JoyStick* self, guchar axis) {
+	g_return_val_if_fail(axis < self->priv->naxes, JOY_AXIS_X);
 	return (enum joy_axis_type)(self->priv->axmap[axis]);
 }
 
@@ -408,10 +2105,15 @@ static void instance_init(GTypeInstance* instance, gpointer g_class) {
 	self->priv = g_new0(JoyStickPrivate, 1);
 	self->priv->ready = FALSE;
 	self->priv->mode = JOY_MODE_MAINLOOP;
+	self->priv->thread_cpu = -1;
 	self->priv->fd = -1;
-	self->priv->butvals = g_array_new(FALSE, TRUE, sizeof(gboolean));
-	self->priv->axvals = g_array_new(FALSE, TRUE, sizeof(gint16));
-	self->priv->axevts = g_array_new(FALSE, TRUE, sizeof(guint32));
+	self->priv->context = g_main_context_ref_thread_default();
+	self->priv->batch = DEFAULT_BATCH;
+	self->priv->backend = &_joy_backend_joydev;
+	self->priv->next_flush = -1;
+	self->priv->repout = g_new0(JoyStickReport, 1);
+	joy_stick_alloc_values(self, 0, 0);
+	g_mutex_init(&self->priv->taplock);
 }
 
 static void get_property(GObject* object, guint property_id, GValue *value, GParamSpec *pspec) {
@@ -435,30 +2137,77 @@ static void get_property(GObject* object, guint property_id, GValue *value, GPar
 	case JOY_INTV:
 		g_value_set_uint(value, self->priv->axintv);
 		break;
+	case JOY_BATCH:
+		g_value_set_uint(value, self->priv->newbatch ? self->priv->newbatch : self->priv->batch);
+		break;
+	case JOY_THRESH:
+		g_value_set_uint(value, self->priv->axthresh);
+		break;
+	case JOY_PRIO:
+		g_value_set_int(value, self->priv->thread_prio);
+		break;
+	case JOY_CPU:
+		g_value_set_int(value, self->priv->thread_cpu);
+		break;
+	case JOY_MLOCK:
+		g_value_set_boolean(value, self->priv->thread_mlock);
+		break;
+	case JOY_OVERFLOWS:
+		g_value_set_uint(value, self->priv->overflows);
+		break;
+	case JOY_GRAB:
+		g_value_set_boolean(value, self->priv->grab);
+		break;
+	case JOY_BACKEND:
+		g_value_set_string(value, self->priv->fd >= 0 ? self->priv->backend->name : NULL);
+		break;
+	case JOY_LATENCY:
+		g_value_set_boolean(value, self->priv->latency != NULL);
+		break;
+	case JOY_EVREAD:
+		g_value_set_uint64(value, COUNTER_GET(self->priv->nread));
+		break;
+	case JOY_EVEMITTED:
+		g_value_set_uint64(value, self->priv->nemitted);
+		break;
+	case JOY_EVCOALESCED:
+		g_value_set_uint64(value, self->priv->ncoalesced);
+		break;
+	case JOY_READCALLS:
+		g_value_set_uint64(value, COUNTER_GET(self->priv->nreadcalls));
+		break;
+	case JOY_KOVERFLOWS:
+		g_value_set_uint64(value, COUNTER_GET(self->priv->koverflows));
+		break;
+	case JOY_PERSISTENT:
+		g_value_set_boolean(value, self->priv->persistent);
+		break;
+	case JOY_IDENTITY:
+		g_value_set_string(value, self->priv->identity);
+		break;
+	case JOY_RECONNECT_LATENCY:
+		g_value_set_int64(value, self->priv->reconnect_latency);
+		break;
 	default:
-		g_assert_not_reached();
-	}
-}
-
-static void finalize(GObject* object) {
-	JoyStick* self = JOY_STICK(object);
-
-	if(self->priv->fd >= 0) {
-		close(self->priv->fd);
-	}
-	if(self->priv->ready) {
-		g_source_remove(self->priv->watch);
-	}
-	if(self->priv->butvals) {
-		g_array_free(self->priv->butvals, TRUE);
-	}
-	if(self->priv->axvals) {
-		g_array_free(self->priv->axvals, TRUE);
-	}
-	if(self->priv->axevts) {
-		g_array_free(self->priv->axevts, TRUE);
+		g_assert_not_reached();
 	}
+}
+
+static void finalize(GObject* object) {
+	JoyStick* self = JOY_STICK(object);
+
+	joy_stick_close(self);
+	g_main_context_unref(self->priv->context);
+	g_free(self->priv->rawbuf);
+	g_free(self->priv->evbuf);
+	g_free(self->priv->latency);
+	g_mutex_clear(&self->priv->taplock);
 	g_hash_table_remove(object_index, self->priv->devname);
+	joy_stick_forget_lost(self);
+	g_free(self->priv->identity);
+	free(self->priv->state);
+	g_slist_free_full(self->priv->retired, free);
+	g_free(self->priv->repout);
 	if(self->priv->devname) {
 		g_free(self->priv->devname);
 	}
@@ -471,9 +2220,59 @@ static void set_property(GObject* object, guint property_id, const GValue *value
 	case JOY_DEVNAME:
 		self->priv->devname = g_value_dup_string(value);
 		joy_stick_reopen(self);
+		joy_stick_update_identity(self);
 		break;
 	case JOY_INTV:
 		self->priv->axintv = g_value_get_uint(value);
+		for(guint i=0; i<self->priv->naxes; i++) {
+			self->priv->axes[i].intv = self->priv->axintv;
+		}
+		break;
+	case JOY_THRESH:
+		self->priv->axthresh = g_value_get_uint(value);
+		for(guint i=0; i<self->priv->naxes; i++) {
+			self->priv->axes[i].thresh = self->priv->axthresh;
+		}
+		break;
+	case JOY_PRIO:
+		self->priv->thread_prio = g_value_get_int(value);
+		break;
+	case JOY_CPU:
+		self->priv->thread_cpu = g_value_get_int(value);
+		break;
+	case JOY_MLOCK:
+		self->priv->thread_mlock = g_value_get_boolean(value);
+		break;
+	case JOY_BATCH:
+		if(self->priv->busy) {
+			self->priv->newbatch = g_value_get_uint(value);
+		} else {
+			self->priv->batch = g_value_get_uint(value);
+			joy_stick_alloc_buffers(self);
+		}
+		break;
+	case JOY_LATENCY:
+		g_clear_pointer(&self->priv->latency, g_free);
+		if(g_value_get_boolean(value)) {
+			self->priv->latency = g_new0(JoyLatencyData, 1);
+		}
+		g_atomic_int_set(&self->priv->measure, self->priv->latency != NULL);
+		break;
+	case JOY_GRAB:
+		self->priv->grab = g_value_get_boolean(value);
+		if(self->priv->fd >= 0) {
+			joy_stick_apply_grab(self);
+		}
+		break;
+	case JOY_PERSISTENT:
+		self->priv->persistent = g_value_get_boolean(value);
+		if(self->priv->persistent) {
+			/* Someone has to watch for the device to return */
+			joy_manager_get_default();
+		}
+		if(self->priv->fd >= 0 || !self->priv->persistent) {
+			joy_stick_update_identity(self);
+		}
 		break;
 	default:
 		g_assert_not_reached();
@@ -483,11 +2282,13 @@ static void set_property(GObject* object, guint property_id, const GValue *value
 static void base_init(gpointer klass G_GNUC_UNUSED) {
 	g_assert(object_index == NULL);
 	object_index = g_hash_table_new(g_str_hash, g_str_equal);
+	lost_index = g_hash_table_new(g_str_hash, g_str_equal);
 }
 
 static void base_finalize(gpointer klass G_GNUC_UNUSED) {
 	g_assert(g_hash_table_size(object_index) == 0);
 	g_hash_table_destroy(object_index);
+	g_hash_table_destroy(lost_index);
 }
 
 static void class_init(gpointer g_class, gpointer g_class_data) {
@@ -497,6 +2298,12 @@ static void class_init(gpointer g_class, gpointer g_class_data) {
 	gobject_class->get_property = get_property;
 	gobject_class->set_property = set_property;
 	gobject_class->finalize = finalize;
+
+	for(guint i=0; i<G_N_ELEMENTS(detail_quarks); i++) {
+		gchar name[4];
+		g_snprintf(name, sizeof(name), "%u", i);
+		detail_quarks[i] = g_quark_from_string(name);
+	}
 /**
   * JoyStick::button-pressed:
   * @object: the object which received the signal.
@@ -552,9 +2359,13 @@ static void class_init(gpointer g_class, gpointer g_class_data) {
   * @newval: the new value of the axis.
   *
   * The #JoyStick::axis-moved signal is emitted when an axis on the
-  * joystick changes its value. However, it will never be issued
+  * joystick changes its value; see joy_stick_get_axis_range() for the
+  * range of @newval. However, it will never be issued
   * more often than permitted by the #JoyStick:axis-interval
-  * property.
+  * property; changes that arrive sooner are coalesced, and the latest
+  * value is issued once the interval has passed. Changes smaller than
+  * the #JoyStick:axis-threshold property, relative to the last issued
+  * value, are not issued at all.
   *
   * The signal will have a detail of the button. E.g., when axis 0
   * changes its value, the detailed event will be `axis-moved:0`. As
@@ -573,6 +2384,9 @@ static void class_init(gpointer g_class, gpointer g_class_data) {
 				2,
 				G_TYPE_UCHAR,
 				G_TYPE_INT);
+	/* GLib only picks a va marshaller by itself for its own
+	 * marshallers */
+	g_signal_set_va_marshaller(klass->axis_moved, G_TYPE_FROM_CLASS(g_class), joy_cclosure_marshal_VOID__UCHAR_INTv);
 /**
   * JoyStick::disconnected:
   * @object: the object which received the signal.
@@ -583,10 +2397,9 @@ static void class_init(gpointer g_class, gpointer g_class_data) {
   *
   * An application should g_object_unref() the joystick, and
   * possibly check to see if the user wants to use another
-  * joystick instead.
-  *
-  * It is not possible to reconnect a #JoyStick object that has lost its
-  * hardware.
+  * joystick instead; unless the joystick is #JoyStick:persistent, in
+  * which case it may keep the #JoyStick and wait for
+  * #JoyStick::reconnected.
   */
 	klass->disconnected =
 	  g_signal_new("disconnected",
@@ -598,6 +2411,91 @@ static void class_init(gpointer g_class, gpointer g_class_data) {
 				g_cclosure_marshal_VOID__VOID,
 				G_TYPE_NONE,
 				0);
+/**
+  * JoyStick::reconnected:
+  * @object: the object which received the signal.
+  *
+  * Emitted when the device of a #JoyStick:persistent joystick that was
+  * disconnected has been plugged in again, and the joystick is open
+  * again. Signal handlers and properties of the #JoyStick are kept; the
+  * #JoyStick:devnode may have changed. The current state of the device
+  * is issued as button and axis signals right after this signal.
+  *
+  * A joystick that was part of a #JoyHub is not added to it again. How
+  * long the reconnection took is available as
+  * #JoyStick:reconnect-latency.
+  */
+	klass->reconnected =
+	  g_signal_new("reconnected",
+				G_TYPE_FROM_CLASS(g_class),
+				G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE,
+				0,
+				NULL,
+				NULL,
+				g_cclosure_marshal_VOID__VOID,
+				G_TYPE_NONE,
+				0);
+/**
+  * JoyStick::report:
+  * @object: the object which received the signal.
+  * @report: (type gpointer): a #JoyStickReport with the axes and buttons
+  * that changed, and the values of all axes and buttons after the report.
+  *
+  * The #JoyStick::report signal is emitted once for every report of the
+  * hardware in which anything changed, after the #JoyStick::button-pressed,
+  * #JoyStick::button-released and #JoyStick::axis-moved signals for the
+  * individual changes. Unlike a sequence of #JoyStick::axis-moved signals,
+  * it never shows a combination of axis values that did not actually
+  * occur (e.g., a diagonal position halfway through an X and Y move).
+  *
+  * For devices that are opened through the evdev interface, a report ends
+  * with every SYN_REPORT of the kernel. The legacy joystick interface
+  * does not mark the end of a report; there, all events with the same
+  * timestamp are one report, and a report also ends when no more events
+  * are pending.
+  *
+  * @report is only valid during the signal emission. It is not affected
+  * by the #JoyStick:axis-interval and #JoyStick:axis-threshold properties.
+  */
+	klass->report =
+	  g_signal_new("report",
+				G_TYPE_FROM_CLASS(g_class),
+				G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE,
+				0,
+				NULL,
+				NULL,
+				g_cclosure_marshal_VOID__POINTER,
+				G_TYPE_NONE,
+				1,
+				G_TYPE_POINTER);
+/**
+  * JoyStick::resynchronized:
+  * @object: the object which received the signal.
+  *
+  * The #JoyStick::resynchronized signal is emitted when the kernel's
+  * buffer for the device overflowed, so that events were lost, and libjoy
+  * has rebuilt the state of the joystick from a state dump of the kernel.
+  *
+  * Before this signal, the button and axis signals (and a
+  * #JoyStick::report) are issued for everything that differs from the
+  * state before the overflow; but presses and releases that happened in
+  * between are lost. An application that counts events rather than
+  * looking at the state should start over.
+  *
+  * The number of overflows is available as #JoyStick:kernel-overflows. In
+  * %JOY_MODE_POLL mode, the state is rebuilt, but this signal is not
+  * issued.
+  */
+	klass->resynchronized =
+	  g_signal_new("resynchronized",
+				G_TYPE_FROM_CLASS(g_class),
+				G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE,
+				0,
+				NULL,
+				NULL,
+				g_cclosure_marshal_VOID__VOID,
+				G_TYPE_NONE,
+				0);
 /**
  * JoyStick:open:
  *
@@ -658,7 +2556,13 @@ static void class_init(gpointer g_class, gpointer g_class_data) {
 /**
  * JoyStick:axis-interval:
  *
- * The minimum interval between axis events, in milliseconds.
+ * The minimum interval between axis events, in milliseconds. Setting
+ * this property sets the interval of all axes; use
+ * joy_stick_set_axis_interval() to set it for a single axis.
+ *
+ * Pending axis values are issued from the thread-default #GMainContext
+ * of the thread that created the #JoyStick; in %JOY_MODE_MANUAL mode,
+ * they are only issued when joy_stick_iteration() is called.
  */
 	props[JOY_INTV] =
 	  g_param_spec_uint("axis-interval",
@@ -668,6 +2572,279 @@ static void class_init(gpointer g_class, gpointer g_class_data) {
 				 G_MAXUINT,
 				 0,
 				 G_PARAM_READWRITE);
+/**
+ * JoyStick:batch-size:
+ *
+ * The maximum number of events that are read from the device with a
+ * single read() call when the joystick is in %JOY_MODE_MAINLOOP mode.
+ * All events that are pending when the device becomes readable are
+ * handled in one main loop dispatch, regardless of this value; it only
+ * determines how many system calls that takes. When set from a signal
+ * handler, it takes effect once the events that were read are handled.
+ */
+	props[JOY_BATCH] =
+	  g_param_spec_uint("batch-size",
+				 "Batch size",
+				 "The maximum number of events to read from the device at once",
+				 1,
+				 4096,
+				 DEFAULT_BATCH,
+				 G_PARAM_READWRITE);
+/**
+ * JoyStick:axis-threshold:
+ *
+ * The minimum change of an axis value, relative to the last value that
+ * was issued for that axis, before a new #JoyStick::axis-moved signal is
+ * issued. Use this to suppress noise from jittery axes. Setting this
+ * property sets the threshold of all axes; use
+ * joy_stick_set_axis_threshold() to set it for a single axis.
+ */
+	props[JOY_THRESH] =
+	  g_param_spec_uint("axis-threshold",
+				 "Axis threshold",
+				 "The minimum change of an axis value before an axis event is issued",
+				 0,
+				 G_MAXUINT16,
+				 0,
+				 G_PARAM_READWRITE);
+/**
+ * JoyStick:thread-priority:
+ *
+ * The SCHED_FIFO priority of the reader thread in %JOY_MODE_THREAD mode,
+ * or 0 to leave the thread in the default scheduling class. Raising the
+ * priority usually requires CAP_SYS_NICE or an appropriate RLIMIT_RTPRIO.
+ *
+ * Changes take effect the next time the reader thread is started.
+ */
+	props[JOY_PRIO] =
+	  g_param_spec_int("thread-priority",
+				"Thread priority",
+				"The SCHED_FIFO priority of the reader thread, or 0 for none",
+				0,
+				99,
+				0,
+				G_PARAM_READWRITE);
+/**
+ * JoyStick:thread-cpu:
+ *
+ * The CPU to which the reader thread is bound in %JOY_MODE_THREAD mode,
+ * or -1 to let the scheduler decide.
+ *
+ * Changes take effect the next time the reader thread is started.
+ */
+	props[JOY_CPU] =
+	  g_param_spec_int("thread-cpu",
+				"Thread CPU",
+				"The CPU to bind the reader thread to, or -1 for any",
+				-1,
+				CPU_SETSIZE - 1,
+				-1,
+				G_PARAM_READWRITE);
+/**
+ * JoyStick:thread-mlock:
+ *
+ * Whether to lock the event buffer of the reader thread in memory in
+ * %JOY_MODE_THREAD mode, so that buffering an event can never cause a
+ * page fault.
+ *
+ * Changes take effect the next time the reader thread is started.
+ */
+	props[JOY_MLOCK] =
+	  g_param_spec_boolean("thread-mlock",
+				    "Thread mlock",
+				    "Whether to lock the reader thread's buffer in memory",
+				    FALSE,
+				    G_PARAM_READWRITE);
+/**
+ * JoyStick:ring-overflows:
+ *
+ * The number of events that were lost because the reader thread's
+ * buffer was full in %JOY_MODE_THREAD mode. This happens when the main
+ * context does not get around to issuing events for a long time.
+ */
+	props[JOY_OVERFLOWS] =
+	  g_param_spec_uint("ring-overflows",
+				 "Ring overflows",
+				 "The number of events lost because the reader thread's buffer was full",
+				 0,
+				 G_MAXUINT,
+				 0,
+				 G_PARAM_READABLE);
+/**
+ * JoyStick:grab:
+ *
+ * Whether to take exclusive access to the device, so that no other
+ * program (including the display server, and the legacy joystick
+ * interface) sees its events while the #JoyStick is open. This is only
+ * supported by the evdev interface (`/dev/input/event*`).
+ */
+	props[JOY_GRAB] =
+	  g_param_spec_boolean("grab",
+				    "Grab",
+				    "Whether to take exclusive access to the device",
+				    FALSE,
+				    G_PARAM_READWRITE);
+/**
+ * JoyStick:backend:
+ *
+ * The kernel interface through which the device is read: "evdev" for
+ * `/dev/input/event*` nodes, or "joydev" for `/dev/input/js*` nodes;
+ * "virtual" for a #JoyVirtual; "replay" for a #JoyPlayer; or %NULL if
+ * the device is not open.
+ */
+	props[JOY_BACKEND] =
+	  g_param_spec_string("backend",
+				    "Backend",
+				    "The kernel interface through which the device is read",
+				    NULL,
+				    G_PARAM_READABLE);
+/**
+ * JoyStick:latency-stats:
+ *
+ * Whether to measure how long it takes to handle events: the time from
+ * the timestamp of the kernel until libjoy reads the event, and from then
+ * until the signals for the event have been issued. See
+ * joy_stick_get_latency_stats() and joy_stick_dump_latency_stats().
+ *
+ * Measuring costs a call to g_get_monotonic_time() per event. Setting
+ * this property (to either value) discards all measurements so far.
+ */
+	props[JOY_LATENCY] =
+	  g_param_spec_boolean("latency-stats",
+				    "Latency statistics",
+				    "Whether to measure how long it takes to handle events",
+				    FALSE,
+				    G_PARAM_READWRITE);
+/**
+ * JoyStick:events-read:
+ *
+ * The number of records that were read from the kernel, including those
+ * that do not result in a signal (e.g., the SYN_REPORT events of the
+ * evdev interface).
+ */
+	props[JOY_EVREAD] =
+	  g_param_spec_uint64("events-read",
+				   "Events read",
+				   "The number of events read from the kernel",
+				   0,
+				   G_MAXUINT64,
+				   0,
+				   G_PARAM_READABLE);
+/**
+ * JoyStick:events-emitted:
+ *
+ * The number of #JoyStick::button-pressed, #JoyStick::button-released and
+ * #JoyStick::axis-moved signals that were issued, whether or not anything
+ * was connected to them.
+ */
+	props[JOY_EVEMITTED] =
+	  g_param_spec_uint64("events-emitted",
+				   "Events emitted",
+				   "The number of button and axis signals issued",
+				   0,
+				   G_MAXUINT64,
+				   0,
+				   G_PARAM_READABLE);
+/**
+ * JoyStick:events-coalesced:
+ *
+ * The number of axis events for which no #JoyStick::axis-moved signal was
+ * issued, either because a later value arrived within the
+ * #JoyStick:axis-interval, or because the change was smaller than the
+ * #JoyStick:axis-threshold.
+ */
+	props[JOY_EVCOALESCED] =
+	  g_param_spec_uint64("events-coalesced",
+				   "Events coalesced",
+				   "The number of axis events that were not issued",
+				   0,
+				   G_MAXUINT64,
+				   0,
+				   G_PARAM_READABLE);
+/**
+ * JoyStick:read-calls:
+ *
+ * The number of read() calls on the device, including those that found
+ * nothing to read. Together with #JoyStick:events-read, this shows how
+ * well events are batched. Devices that are read by a #JoyHub with the
+ * io_uring backend are not read with read() at all.
+ */
+	props[JOY_READCALLS] =
+	  g_param_spec_uint64("read-calls",
+				   "Read calls",
+				   "The number of read() calls on the device",
+				   0,
+				   G_MAXUINT64,
+				   0,
+				   G_PARAM_READABLE);
+/**
+ * JoyStick:kernel-overflows:
+ *
+ * The number of times the kernel's buffer for the device overflowed, so
+ * that events were lost. See #JoyStick::resynchronized.
+ */
+	props[JOY_KOVERFLOWS] =
+	  g_param_spec_uint64("kernel-overflows",
+				   "Kernel overflows",
+				   "The number of times events were lost in the kernel",
+				   0,
+				   G_MAXUINT64,
+				   0,
+				   G_PARAM_READABLE);
+/**
+ * JoyStick:persistent:
+ *
+ * Whether to reconnect the joystick when its device is plugged in again
+ * after a #JoyStick::disconnected signal, rather than leave it closed
+ * for good. The device is recognized by its #JoyStick:identity, and is
+ * watched for by the #JoyManager, which is created by setting this
+ * property if it did not exist yet; see #JoyStick::reconnected.
+ *
+ * Only joysticks that were created in the global default #GMainContext,
+ * on kernel device nodes that udev knows the identity of, can be
+ * reconnected.
+ */
+	props[JOY_PERSISTENT] =
+	  g_param_spec_boolean("persistent",
+				    "Persistent",
+				    "Whether to reconnect the joystick when its device returns",
+				    FALSE,
+				    G_PARAM_READWRITE);
+/**
+ * JoyStick:identity:
+ *
+ * What identifies the device of a #JoyStick:persistent joystick across
+ * unplugging it and plugging it in again: the serial number of the
+ * device (udev's `ID_SERIAL`) if it has one, or otherwise the port it is
+ * plugged into (udev's `ID_PATH`), along with the kind of device node.
+ * %NULL if the joystick is not persistent, or if there is no identity.
+ *
+ * Two devices of the same model without a serial number are told apart
+ * by their port; so such a device is only reconnected when it is
+ * plugged into the same port again.
+ */
+	props[JOY_IDENTITY] =
+	  g_param_spec_string("identity",
+				    "Identity",
+				    "The stable identity of the device of a persistent joystick",
+				    NULL,
+				    G_PARAM_READABLE);
+/**
+ * JoyStick:reconnect-latency:
+ *
+ * For the last #JoyStick::reconnected signal: the time, in
+ * microseconds, from when udev had set up the device that was plugged in
+ * again until the joystick was open again. 0 if the joystick was never
+ * reconnected.
+ */
+	props[JOY_RECONNECT_LATENCY] =
+	  g_param_spec_int64("reconnect-latency",
+				  "Reconnect latency",
+				  "The time it took to reopen the device when it was plugged in again (in microseconds)",
+				  0,
+				  G_MAXINT64,
+				  0,
+				  G_PARAM_READABLE);
 	g_object_class_install_properties(gobject_class, JOY_PROP_COUNT, props);
 }
 
@@ -704,35 +2881,17 @@ GType joy_stick_get_type(void) {
   * %JOY_MODE_MAINLOOP mode.
   */
 void joy_stick_iteration(JoyStick* self) {
-	struct js_event ev;
 	int rv;
-	if((rv = read(self->priv->fd, &ev, sizeof(ev))) < 0) {
+
+	rv = read(self->priv->fd, self->priv->rawbuf, self->priv->backend->record_size);
+	self->priv->nreadcalls++;
+	if(rv <= 0) {
 		return;
 	}
-	/* XXX if(ev.type & JS_EVENT_INIT) */
-	ev.type &= ~JS_EVENT_INIT;
-	gchar* name = g_strdup_printf("%u", ev.number);
-	GQuark quark = g_quark_from_string(name);
-	g_free(name);
-	switch(ev.type) {
-		case JS_EVENT_BUTTON:
-			g_array_index(self->priv->butvals, gboolean, ev.number) = ev.value ? TRUE : FALSE;
-			if(ev.value) {
-				g_signal_emit(self, JOY_STICK_GET_CLASS(self)->button_pressed, quark, ev.number);
-			} else {
-				g_signal_emit(self, JOY_STICK_GET_CLASS(self)->button_released, quark, ev.number);
-			}
-			break;
-		case JS_EVENT_AXIS:
-			g_array_index(self->priv->butvals, gint16, ev.number) = ev.value;
-			if(ev.time > (g_array_index(self->priv->axevts, guint32, ev.number) + self->priv->axintv)) {
-				g_signal_emit(self, JOY_STICK_GET_CLASS(self)->axis_moved, quark, ev.number, ev.value);
-			}
-			break;
-		default:
-			break;
+	joy_stick_process_records(self, self->priv->rawbuf, 1);
+	if(self->priv->next_flush >= 0 && g_get_monotonic_time() >= self->priv->next_flush) {
+		joy_stick_flush_axes(self);
 	}
-	return;
 }
 
 /** 
@@ -762,12 +2921,9 @@ void joy_stick_loop(JoyStick* self) {
   */
 void joy_stick_set_mode(JoyStick* self, JoyMode mode) {
 	if(self->priv->mode != mode) {
-		if(mode == JOY_MODE_MANUAL) {
-			g_source_remove(self->priv->watch);
-		} else {
-			self->priv->watch = g_unix_fd_add(self->priv->fd, G_IO_IN | G_IO_ERR | G_IO_HUP, handle_joystick_event, self);
-		}
+		joy_stick_stop(self);
 		self->priv->mode = mode;
+		joy_stick_start(self);
 	}
 }
 
@@ -816,3 +2972,274 @@ gint16 joy_stick_get_typed_button(JoyStick* self, JoyBtnType type) {
 	}
 	return -1;
 }
+
+/**
+  * joy_stick_set_axis_interval:
+  * @self: a #JoyStick
+  * @axis: the axis to configure
+  * @interval: the minimum interval between two events, in milliseconds
+  *
+  * Set the minimum interval between two #JoyStick::axis-moved signals for
+  * a single axis, overriding the #JoyStick:axis-interval property.
+  */
+void joy_stick_set_axis_interval(JoyStick* self, guchar axis, guint interval) {
+	g_return_if_fail(axis < self->priv->naxes);
+	self->priv->axes[axis].intv = interval;
+}
+
+/**
+  * joy_stick_set_axis_threshold:
+  * @self: a #JoyStick
+  * @axis: the axis to configure
+  * @threshold: the minimum change of the axis value
+  *
+  * Set the minimum change of the value of a single axis before a
+  * #JoyStick::axis-moved signal is issued for it, overriding the
+  * #JoyStick:axis-threshold property.
+  */
+void joy_stick_set_axis_threshold(JoyStick* self, guchar axis, guint threshold) {
+	g_return_if_fail(axis < self->priv->naxes);
+	self->priv->axes[axis].thresh = MIN(threshold, G_MAXUINT16);
+}
+
+/**
+  * joy_stick_poll:
+  * @self: a #JoyStick
+  *
+  * Read all events that are pending on the device, without blocking, and
+  * update the state of the joystick accordingly. No signals are issued for
+  * these events; use joy_stick_get_values() to retrieve the resulting
+  * state.
+  *
+  * This function may only be used in %JOY_MODE_POLL mode. If the device
+  * has gone away, the #JoyStick::disconnected signal is issued.
+  *
+  * Returns: the number of events that were read, or -1 if the device is
+  * no longer available.
+  */
+gint joy_stick_poll(JoyStick* self) {
+	gssize count;
+
+	g_return_val_if_fail(self->priv->mode == JOY_MODE_POLL, -1);
+	if(!self->priv->ready) {
+		return -1;
+	}
+	count = joy_stick_drain(self);
+	if(count < 0) {
+		joy_stick_disconnect(self);
+		return -1;
+	}
+	return count;
+}
+
+/**
+  * joy_stick_get_values:
+  * @self: a #JoyStick
+  * @axes: (array length=n_axes) (out caller-allocates) (allow-none): an
+  * array to store the axis values in, or %NULL
+  * @n_axes: the number of elements in @axes
+  * @buttons: (array length=n_buttons) (out caller-allocates) (allow-none):
+  * an array to store the button states in, or %NULL
+  * @n_buttons: the number of elements in @buttons
+  *
+  * Retrieve the current value of all axes and the current state of all
+  * buttons in one call. If the joystick has fewer axes or buttons than
+  * there is room for in the arrays, the remaining elements are set to 0
+  * (or %FALSE).
+  */
+void joy_stick_get_values(JoyStick* self, gint32* axes, guint8 n_axes, gboolean* buttons, guint8 n_buttons) {
+	JoyStickState state;
+
+	joy_stick_snapshot(self, &state);
+	if(axes) {
+		for(guint i=0; i<n_axes; i++) {
+			axes[i] = i < state.n_axes ? state.axes[i] : 0;
+		}
+	}
+	if(buttons) {
+		for(guint i=0; i<n_buttons; i++) {
+			buttons[i] = i < state.n_buttons ? JOY_STICK_STATE_BUTTON(&state, i) : FALSE;
+		}
+	}
+}
+
+/**
+  * joy_stick_snapshot:
+  * @self: a #JoyStick
+  * @state: (out caller-allocates): a #JoyStickState to copy the state to
+  *
+  * Copy the current state of all axes and buttons of the joystick, along
+  * with the timestamp of the last event, into @state.
+  *
+  * Unlike all other functions of #JoyStick, this function may be called
+  * from any thread, no matter what thread issues the events (as long as
+  * the caller ensures the #JoyStick is not finalized while it runs). It
+  * takes no locks; the copy is guaranteed to be consistent, i.e., it never
+  * contains half of a batch of events that was read from the device.
+  */
+void joy_stick_snapshot(JoyStick* self, JoyStickState* state) {
+	JoyValues* values;
+	guint nwords;
+	gint seq;
+
+	do {
+		seq = g_atomic_int_get(&self->priv->seq);
+		if(seq & 1) {
+			/* The writer is busy */
+			sched_yield();
+			continue;
+		}
+		/* The counts are taken from the block itself, so that they
+		 * always match its size */
+		values = g_atomic_pointer_get(&self->priv->state);
+		state->time = values->time;
+		state->n_axes = values->n_axes;
+		state->n_buttons = values->n_buttons;
+		memcpy(state->buttons, values->words, values->n_words * sizeof(guint64));
+		memcpy(state->axes, joy_values_axes(values), values->n_axes * sizeof(gint32));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while((seq & 1) || g_atomic_int_get(&self->priv->seq) != seq);
+	nwords = (state->n_buttons + 63) / 64;
+	memset(state->buttons + nwords, 0, (G_N_ELEMENTS(state->buttons) - nwords) * sizeof(guint64));
+	memset(state->axes + state->n_axes, 0, (G_N_ELEMENTS(state->axes) - state->n_axes) * sizeof(gint32));
+}
+
+/**
+  * joy_stick_get_axes:
+  * @self: a #JoyStick
+  * @axes: (array length=n_axes) (out caller-allocates): an array to store
+  * the axis values in
+  * @n_axes: the number of elements in @axes
+  *
+  * Retrieve the current value of all axes in one call.
+  *
+  * Like joy_stick_snapshot(), this function may be called from any thread.
+  *
+  * Returns: the number of elements of @axes that were filled in.
+  */
+guint8 joy_stick_get_axes(JoyStick* self, gint32* axes, guint8 n_axes) {
+	JoyStickState state;
+	guint8 count;
+
+	joy_stick_snapshot(self, &state);
+	count = MIN(n_axes, state.n_axes);
+	memcpy(axes, state.axes, count * sizeof(gint32));
+	return count;
+}
+
+/**
+  * joy_stick_get_button_mask:
+  * @self: a #JoyStick
+  * @mask: (array length=n_words) (out caller-allocates): an array of 64-bit
+  * words to store the button states in
+  * @n_words: the number of elements in @mask
+  *
+  * Retrieve the current state of all buttons in one call, as a bitmask:
+  * button n is pressed if bit (n % 64) of `mask[n / 64]` is set. A single
+  * #guint64 covers the first 64 buttons, which is enough for most
+  * joysticks, and allows one to check for button combinations with a
+  * single comparison. Bits for buttons that do not exist are cleared.
+  *
+  * Like joy_stick_snapshot(), this function may be called from any thread.
+  *
+  * Returns: the number of buttons on the joystick.
+  */
+guint8 joy_stick_get_button_mask(JoyStick* self, guint64* mask, guint n_words) {
+	JoyStickState state;
+
+	joy_stick_snapshot(self, &state);
+	for(guint i=0; i<n_words; i++) {
+		mask[i] = i < G_N_ELEMENTS(state.buttons) ? state.buttons[i] : 0;
+	}
+	return state.n_buttons;
+}
+
+/**
+  * joy_stick_get_event_time:
+  * @self: a #JoyStick
+  *
+  * Look up when the event that is being issued happened. When called from
+  * a handler of one of the signals of @self, this is the time of the event
+  * the signal is issued for (for an #JoyStick::axis-moved signal that was
+  * held back due to the #JoyStick:axis-interval property, the time of the
+  * event that set the value being issued); otherwise, it is the time of
+  * the last event that was issued.
+  *
+  * The time is taken from the kernel, not from when libjoy read the event,
+  * and is on the same clock as g_get_monotonic_time(); so the difference
+  * between the two is the time it took to get the event to the
+  * application. Timestamps from the legacy joystick interface only have
+  * millisecond resolution, and are mapped onto that clock by libjoy.
+  *
+  * Returns: the time of the event, in microseconds, or 0 if no event has
+  * been issued yet.
+  */
+gint64 joy_stick_get_event_time(JoyStick* self) {
+	return self->priv->evtime;
+}
+
+/**
+  * joy_stick_get_latency_stats:
+  * @self: a #JoyStick
+  * @stats: (out caller-allocates): a #JoyLatencyStats to store the
+  * statistics in
+  *
+  * Retrieve the latency statistics that were gathered since the
+  * #JoyStick:latency-stats property was set. Events for which no signals
+  * are issued (e.g., in %JOY_MODE_POLL mode) only count towards the read
+  * latency. The dispatch latency of an axis event ends when its
+  * #JoyStick::axis-moved signal would have been issued, had it not been
+  * held back by the #JoyStick:axis-interval property.
+  *
+  * Returns: %TRUE, or %FALSE if latency statistics are not enabled.
+  */
+gboolean joy_stick_get_latency_stats(JoyStick* self, JoyLatencyStats* stats) {
+	JoyLatencyData* latency = self->priv->latency;
+
+	if(!latency) {
+		return FALSE;
+	}
+	joy_histogram_summarize(&latency->read, &stats->read);
+	joy_histogram_summarize(&latency->dispatch, &stats->dispatch);
+	joy_histogram_summarize(&latency->total, &stats->total);
+	return TRUE;
+}
+
+static void joy_histogram_dump(GString* str, const gchar* name, JoyHistogram* hist) {
+	JoyLatency latency;
+
+	joy_histogram_summarize(hist, &latency);
+	g_string_append_printf(str, "%s: count=%" G_GUINT64_FORMAT " p50=%" G_GINT64_FORMAT "us p99=%" G_GINT64_FORMAT "us max=%" G_GINT64_FORMAT "us\n",
+		name, latency.count, latency.p50, latency.p99, latency.max);
+	for(guint i=0; i<HIST_BUCKETS; i++) {
+		if(!hist->buckets[i]) {
+			continue;
+		}
+		g_string_append_printf(str, "  <=%" G_GINT64_FORMAT "us: %u\n", joy_histogram_bucket_max(i), hist->buckets[i]);
+	}
+}
+
+/**
+  * joy_stick_dump_latency_stats:
+  * @self: a #JoyStick
+  *
+  * Describe the latency statistics of @self in human-readable form: the
+  * summary of joy_stick_get_latency_stats(), followed by the non-empty
+  * buckets of the underlying histograms.
+  *
+  * Returns: (transfer full): a newly-allocated string, or %NULL if
+  * latency statistics are not enabled.
+  */
+gchar* joy_stick_dump_latency_stats(JoyStick* self) {
+	GString* str;
+
+	if(!self->priv->latency) {
+		return NULL;
+	}
+	str = g_string_new(NULL);
+	g_string_append_printf(str, "%s (%s)\n", self->priv->devname, self->priv->name);
+	joy_histogram_dump(str, "read", &self->priv->latency->read);
+	joy_histogram_dump(str, "dispatch", &self->priv->latency->dispatch);
+	joy_histogram_dump(str, "total", &self->priv->latency->total);
+	return g_string_free(str, FALSE);
+}
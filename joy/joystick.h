@@ -21,6 +21,7 @@
 #define LIBJOY_H
 
 #include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -186,16 +187,140 @@ typedef enum joy_button_type {
   * JoyMode:
   * @JOY_MODE_MANUAL: libjoy will do nothing; the program must call
   * joy_stick_iteration() or joy_stick_loop() for events to be issued.
-  * @JOY_MODE_MAINLOOP: libjoy will add a #GSource to the glib mainloop, and
-  * will issue events from that #GSource.
+  * @JOY_MODE_MAINLOOP: libjoy will add a #GSource to the thread-default
+  * #GMainContext of the thread that created the #JoyStick, and will issue
+  * events from that #GSource. All events that are pending when the device
+  * becomes readable are issued in one dispatch; see #JoyStick:batch-size.
+  * @JOY_MODE_THREAD: libjoy will start a thread which reads events from the
+  * device as soon as they arrive and buffers them; the buffered events are
+  * then issued in batches from the same #GMainContext as in
+  * %JOY_MODE_MAINLOOP mode. See #JoyStick:thread-priority,
+  * #JoyStick:thread-cpu and #JoyStick:thread-mlock.
+  * @JOY_MODE_POLL: libjoy will not issue any events; the program must call
+  * joy_stick_poll() to update the state of the joystick, and can then
+  * retrieve that state with joy_stick_get_values().
   *
   * The mode in which a joystick is running.
   */
 typedef enum {
 	JOY_MODE_MANUAL,
 	JOY_MODE_MAINLOOP,
+	JOY_MODE_THREAD,
+	JOY_MODE_POLL,
 } JoyMode;
 
+#define JOY_STICK_MAX_AXES	64
+#define JOY_STICK_MAX_BUTTONS	256
+
+/**
+  * JoyStickState:
+  * @time: the timestamp of the last event, in microseconds, on the same
+  * clock as g_get_monotonic_time()
+  * @n_axes: the number of valid elements in @axes
+  * @n_buttons: the number of valid bits in @buttons
+  * @axes: the value of each axis, in the range reported by
+  * joy_stick_get_axis_range()
+  * @buttons: the state of each button, as a bitmask; use
+  * JOY_STICK_STATE_BUTTON() to test a button.
+  *
+  * A copy of the state of a joystick, as returned by joy_stick_snapshot().
+  */
+typedef struct _JoyStickState {
+	gint64 time;
+	guint8 n_axes;
+	guint8 n_buttons;
+	gint32 axes[JOY_STICK_MAX_AXES];
+	guint64 buttons[JOY_STICK_MAX_BUTTONS / 64];
+} JoyStickState;
+
+/**
+  * JOY_STICK_STATE_BUTTON:
+  * @state: a pointer to a #JoyStickState
+  * @n: the number of a button
+  *
+  * Evaluates to %TRUE if button @n is pressed in @state.
+  */
+#define JOY_STICK_STATE_BUTTON(state, n) ((gboolean)(((state)->buttons[(n) / 64] >> ((n) % 64)) & 1))
+
+/**
+  * JoyStickReport:
+  * @time: the timestamp of the report, in microseconds, on the same clock
+  * as g_get_monotonic_time()
+  * @changed_axes: a bitmask of the axes that changed in this report; use
+  * JOY_STICK_REPORT_AXIS_CHANGED() to test an axis.
+  * @changed_buttons: a bitmask of the buttons that changed in this report;
+  * use JOY_STICK_REPORT_BUTTON_CHANGED() to test a button.
+  * @n_axes: the number of valid elements in @axes
+  * @n_buttons: the number of valid bits in @buttons
+  * @axes: the value of each axis after this report
+  * @buttons: the state of each button after this report, as a bitmask; use
+  * JOY_STICK_STATE_BUTTON() to test a button.
+  *
+  * One report of the hardware, as passed to the #JoyStick::report signal.
+  */
+typedef struct _JoyStickReport {
+	gint64 time;
+	guint64 changed_axes;
+	guint64 changed_buttons[JOY_STICK_MAX_BUTTONS / 64];
+	guint8 n_axes;
+	guint8 n_buttons;
+	gint32 axes[JOY_STICK_MAX_AXES];
+	guint64 buttons[JOY_STICK_MAX_BUTTONS / 64];
+} JoyStickReport;
+
+/**
+  * JOY_STICK_REPORT_AXIS_CHANGED:
+  * @report: a pointer to a #JoyStickReport
+  * @n: the number of an axis
+  *
+  * Evaluates to %TRUE if axis @n changed in @report.
+  */
+#define JOY_STICK_REPORT_AXIS_CHANGED(report, n) ((gboolean)(((report)->changed_axes >> (n)) & 1))
+
+/**
+  * JOY_STICK_REPORT_BUTTON_CHANGED:
+  * @report: a pointer to a #JoyStickReport
+  * @n: the number of a button
+  *
+  * Evaluates to %TRUE if button @n changed in @report.
+  */
+#define JOY_STICK_REPORT_BUTTON_CHANGED(report, n) ((gboolean)(((report)->changed_buttons[(n) / 64] >> ((n) % 64)) & 1))
+
+/**
+  * JoyLatency:
+  * @count: the number of events measured
+  * @p50: the median latency, in microseconds
+  * @p99: the 99th percentile of the latency, in microseconds
+  * @max: the highest latency, in microseconds
+  *
+  * Latency statistics of one stage of handling events. The percentiles
+  * are approximate: they are the upper bound of a histogram bucket, and
+  * are accurate to within 25%.
+  */
+typedef struct _JoyLatency {
+	guint64 count;
+	gint64 p50;
+	gint64 p99;
+	gint64 max;
+} JoyLatency;
+
+/**
+  * JoyLatencyStats:
+  * @read: from the timestamp of the kernel to libjoy reading the event
+  * @dispatch: from libjoy reading the event to the end of issuing the
+  * signals for it
+  * @total: from the timestamp of the kernel to the end of issuing the
+  * signals for the event
+  *
+  * Latency statistics of a #JoyStick, as returned by
+  * joy_stick_get_latency_stats(). See #JoyStick:latency-stats.
+  */
+typedef struct _JoyLatencyStats {
+	JoyLatency read;
+	JoyLatency dispatch;
+	JoyLatency total;
+} JoyLatencyStats;
+
 typedef struct _JoyStick JoyStick;
 typedef struct _JoyStickClass JoyStickClass;
 typedef struct _JoyStickPrivate JoyStickPrivate;
@@ -217,6 +342,11 @@ struct _JoyStick {
   * @button_released: signal emitted when a button is released
   * @axis_moved: signal emitted when an axis is removed
   * @disconnected: signal emitted when the joystick is disconnected.
+  * @report: signal emitted once for every report of the hardware.
+  * @resynchronized: signal emitted when the state of the joystick has been
+  * rebuilt after the kernel dropped events.
+  * @reconnected: signal emitted when the device of a persistent joystick
+  * was plugged in again.
   *
   * The signals are only visible so that subclasses (if any) can  use
   * them.
@@ -231,11 +361,27 @@ struct _JoyStickClass {
 	guint button_released;
 	guint axis_moved;
 	guint disconnected;
+	guint report;
+	guint resynchronized;
+	guint reconnected;
 };
 
+/**
+  * JoyStickFoundFunc:
+  * @stick: a #JoyStick that was found
+  * @user_data: the data passed to joy_stick_enumerate_async()
+  *
+  * The type of the function that joy_stick_enumerate_async() calls for
+  * each joystick as soon as it is open. The reference to @stick belongs
+  * to the enumeration; take one of your own to keep it.
+  */
+typedef void (*JoyStickFoundFunc)(JoyStick* stick, gpointer user_data);
+
 /* constructors & class functions */
 JoyStick* joy_stick_open(const gchar* devname);
 GList* joy_stick_enumerate();
+void joy_stick_enumerate_async(GCancellable* cancellable, JoyStickFoundFunc found, gpointer found_data, GDestroyNotify found_destroy, GAsyncReadyCallback callback, gpointer user_data);
+GList* joy_stick_enumerate_finish(GAsyncResult* result, GError** err);
 void joy_stick_enum_free(GList* enumeration);
 gchar* joy_stick_describe_unopened(gchar* devname);
 /* instance functions */
@@ -249,9 +395,20 @@ JoyBtnType joy_stick_get_button_type(JoyStick* self, guchar button);
 JoyAxisType joy_stick_get_axis_type(JoyStick* self, guchar axis);
 gint16 joy_stick_get_typed_axis(JoyStick* self, JoyAxisType type);
 gint16 joy_stick_get_typed_button(JoyStick* self, JoyBtnType type);
+gboolean joy_stick_get_axis_range(JoyStick* self, guchar axis, gint* min, gint* max);
 void joy_stick_set_mode(JoyStick* self, JoyMode mode);
+void joy_stick_set_axis_interval(JoyStick* self, guchar axis, guint interval);
+void joy_stick_set_axis_threshold(JoyStick* self, guchar axis, guint threshold);
 void joy_stick_iteration(JoyStick* self);
 void joy_stick_loop(JoyStick* self);
+gint joy_stick_poll(JoyStick* self);
+void joy_stick_get_values(JoyStick* self, gint32* axes, guint8 n_axes, gboolean* buttons, guint8 n_buttons);
+void joy_stick_snapshot(JoyStick* self, JoyStickState* state);
+guint8 joy_stick_get_axes(JoyStick* self, gint32* axes, guint8 n_axes);
+guint8 joy_stick_get_button_mask(JoyStick* self, guint64* mask, guint n_words);
+gint64 joy_stick_get_event_time(JoyStick* self);
+gboolean joy_stick_get_latency_stats(JoyStick* self, JoyLatencyStats* stats);
+gchar* joy_stick_dump_latency_stats(JoyStick* self);
 
 /* type handling functions */
 GType joy_stick_get_type(void) G_GNUC_PURE;
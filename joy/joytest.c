@@ -31,6 +31,8 @@
 #define _(s) (s)
 #endif
 
+#define MAX_CONTROLS 256
+
 JoyStick* active;
 
 gulong button_p_handler;
@@ -38,24 +40,299 @@ gulong button_r_handler;
 gulong axis_handler;
 gulong lost_handler;
 
-static void button_pressed(JoyStick* stick, guchar butnum, gpointer data) {
-	GtkGrid* grid = GTK_GRID(data);
+/* The widgets for the axes and buttons of the active joystick, so that
+ * updating one does not need a search through the grid */
+static GtkWidget* axis_labels[MAX_CONTROLS];
+static GtkWidget* button_checks[MAX_CONTROLS];
+static guchar axis_count;
+static guchar button_count;
+
+/* Events only update these, and mark what changed; frame_update() then
+ * applies all changes to the widgets once per frame */
+static gint32 axis_values[MAX_CONTROLS];
+static gboolean button_values[MAX_CONTROLS];
+static guint32 axis_dirty[MAX_CONTROLS / 32];
+static guint32 button_dirty[MAX_CONTROLS / 32];
+static GdkFrameClock* clock;
+static gboolean frame_requested;
+
+/* Statistics, shown and reset once per second */
+static GtkLabel* stats_label;
+static guint stats_events;
+static guint stats_frames;
+static gint64 stats_apply;
+static gint64 stats_apply_max;
+static gint64 stats_start;
+
+/* Each axis has a plot of its last HISTORY_SECONDS of values. Samples are
+ * kept in a ring buffer, and the plot is cached in a surface that is
+ * scrolled once per frame; only the samples that arrived since the
+ * previous frame are then drawn onto it */
+#define HISTORY_SECONDS 10
+#define HISTORY_SIZE 16384	/* a power of two; room for 1 kHz */
+#define PLOT_HEIGHT 48
+
+typedef struct {
+	gint64 times[HISTORY_SIZE];
+	gint32 values[HISTORY_SIZE];
+	guint64 head;		/* the number of samples stored */
+	guint64 drawn;		/* the number of samples on the surface */
+	gint32 last;		/* the value at the right edge of the surface */
+	gint min;
+	gint max;
+	GtkWidget* label;
+	GtkWidget* area;
+	cairo_surface_t* surface;
+	cairo_surface_t* spare;
+	gint width;
+	gint height;
+	gint64 edge;		/* the time at the right edge of the surface */
+} AxisHistory;
+
+static AxisHistory* histories[MAX_CONTROLS];
+
+static void request_frame(void) {
+	if(!frame_requested && clock) {
+		gdk_frame_clock_request_phase(clock, GDK_FRAME_CLOCK_PHASE_UPDATE);
+		frame_requested = TRUE;
+	}
+}
 
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_grid_get_child_at(grid, butnum+2, 1)), TRUE);
+static void set_button(guchar butnum, gboolean pressed) {
+	button_values[butnum] = pressed;
+	button_dirty[butnum / 32] |= 1U << (butnum % 32);
+	stats_events++;
+	request_frame();
 }
 
-static void button_released(JoyStick* stick, guchar butnum, gpointer data) {
-	GtkGrid* grid = GTK_GRID(data);
+static void button_pressed(JoyStick* stick, guchar butnum, gpointer data) {
+	set_button(butnum, TRUE);
+}
 
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(gtk_grid_get_child_at(grid, butnum+2, 1)), FALSE);
+static void button_released(JoyStick* stick, guchar butnum, gpointer data) {
+	set_button(butnum, FALSE);
 }
 
 static void axis_moved(JoyStick* stick, guchar axis, int newval, gpointer data) {
-	GtkGrid* grid = GTK_GRID(data);
+	AxisHistory* h = histories[axis];
+
+	if(h) {
+		h->times[h->head % HISTORY_SIZE] = joy_stick_get_event_time(stick);
+		h->values[h->head % HISTORY_SIZE] = newval;
+		h->head++;
+	}
+	axis_values[axis] = newval;
+	axis_dirty[axis / 32] |= 1U << (axis % 32);
+	stats_events++;
+	request_frame();
+}
+
+static gdouble plot_y(AxisHistory* h, gint32 value) {
+	value = CLAMP(value, h->min, h->max);
+	return h->height - 0.5 - (gdouble)(value - h->min) * (h->height - 1) / (h->max - h->min);
+}
+
+static void plot_clear(AxisHistory* h, cairo_t* cr, gdouble x) {
+	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+	cairo_rectangle(cr, x, 0, h->width - x, h->height);
+	cairo_fill(cr);
+}
+
+/* Draw the samples that are not on the surface yet, as a step line that
+ * starts at @x and is held up to the right edge */
+static void plot_samples(AxisHistory* h, cairo_t* cr, gdouble x) {
+	gdouble scale = (gdouble)h->width / (HISTORY_SECONDS * G_USEC_PER_SEC);
+
+	if(h->head - h->drawn > HISTORY_SIZE) {
+		h->drawn = h->head - HISTORY_SIZE;
+	}
+	cairo_set_source_rgb(cr, 0.1, 0.3, 0.7);
+	cairo_set_line_width(cr, 1.0);
+	cairo_move_to(cr, x, plot_y(h, h->last));
+	for(; h->drawn < h->head; h->drawn++) {
+		guint i = h->drawn % HISTORY_SIZE;
+		gdouble sx = h->width - (h->edge - h->times[i]) * scale;
+
+		x = CLAMP(sx, x, h->width);
+		cairo_line_to(cr, x, plot_y(h, h->last));
+		h->last = h->values[i];
+		cairo_line_to(cr, x, plot_y(h, h->last));
+	}
+	cairo_line_to(cr, h->width, plot_y(h, h->last));
+	cairo_stroke(cr);
+}
+
+/* Redraw the whole plot from the ring buffer; only needed when the size
+ * of the plot changes, or when another joystick is selected */
+static void plot_reset(AxisHistory* h, gint64 now) {
+	GdkWindow* window = gtk_widget_get_window(h->area);
+	cairo_t* cr;
+
+	g_clear_pointer(&h->surface, cairo_surface_destroy);
+	g_clear_pointer(&h->spare, cairo_surface_destroy);
+	h->width = gtk_widget_get_allocated_width(h->area);
+	h->height = gtk_widget_get_allocated_height(h->area);
+	h->surface = gdk_window_create_similar_surface(window, CAIRO_CONTENT_COLOR, h->width, h->height);
+	h->spare = gdk_window_create_similar_surface(window, CAIRO_CONTENT_COLOR, h->width, h->height);
+	h->edge = now;
+
+	h->drawn = h->head > HISTORY_SIZE ? h->head - HISTORY_SIZE : 0;
+	if(h->drawn < h->head) {
+		h->last = h->values[h->drawn % HISTORY_SIZE];
+	}
+	cr = cairo_create(h->surface);
+	plot_clear(h, cr, 0);
+	plot_samples(h, cr, 0);
+	cairo_destroy(cr);
+}
+
+/* Move the plot to the left by the number of whole pixels that passed
+ * since the previous frame, and draw what is new */
+static void plot_scroll(AxisHistory* h, gint64 now) {
+	gdouble usec_per_px;
+	gint64 shift;
+	cairo_t* cr;
+
+	if(!h->surface || h->width <= 0) {
+		return;
+	}
+	usec_per_px = (gdouble)HISTORY_SECONDS * G_USEC_PER_SEC / h->width;
+	shift = (now - h->edge) / usec_per_px;
+	if(shift <= 0) {
+		if(h->drawn == h->head) {
+			return;
+		}
+		cr = cairo_create(h->surface);
+		plot_samples(h, cr, h->width);
+	} else {
+		cairo_surface_t* tmp;
+
+		cr = cairo_create(h->spare);
+		cairo_set_source_surface(cr, h->surface, -shift, 0);
+		cairo_paint(cr);
+		plot_clear(h, cr, h->width - shift);
+		if(shift >= h->width) {
+			h->edge = now;
+		} else {
+			h->edge += shift * usec_per_px;
+		}
+		plot_samples(h, cr, h->width - shift);
+		tmp = h->surface;
+		h->surface = h->spare;
+		h->spare = tmp;
+	}
+	cairo_destroy(cr);
+	gtk_widget_queue_draw(h->area);
+}
+
+static gboolean plot_draw(GtkWidget* area, cairo_t* cr, gpointer data) {
+	AxisHistory* h = data;
+
+	if(gtk_widget_get_allocated_width(area) != h->width || gtk_widget_get_allocated_height(area) != h->height) {
+		plot_reset(h, clock ? gdk_frame_clock_get_frame_time(clock) : g_get_monotonic_time());
+	}
+	cairo_set_source_surface(cr, h->surface, 0, 0);
+	cairo_paint(cr);
 
-	gchar* val = g_strdup_printf("%d", newval);
-	gtk_label_set_text(GTK_LABEL(gtk_grid_get_child_at(grid, axis+2, 2)), val);
-	g_free(val);
+	return FALSE;
+}
+
+static AxisHistory* history_new(GtkGrid* grid, guchar axis) {
+	AxisHistory* h = g_new0(AxisHistory, 1);
+	gchar* text = g_strdup_printf(_("Axis %u:"), axis);
+
+	h->label = gtk_label_new(text);
+	g_free(text);
+	gtk_grid_attach(grid, h->label, 0, axis+4, 1, 1);
+	h->area = gtk_drawing_area_new();
+	gtk_widget_set_size_request(h->area, -1, PLOT_HEIGHT);
+	gtk_widget_set_hexpand(h->area, TRUE);
+	g_signal_connect(G_OBJECT(h->area), "draw", G_CALLBACK(plot_draw), h);
+	gtk_grid_attach(grid, h->area, 1, axis+4, 1, 1);
+
+	return h;
+}
+
+static void history_free(AxisHistory* h) {
+	gtk_widget_destroy(h->label);
+	gtk_widget_destroy(h->area);
+	g_clear_pointer(&h->surface, cairo_surface_destroy);
+	g_clear_pointer(&h->spare, cairo_surface_destroy);
+	g_free(h);
+}
+
+static void frame_update(GdkFrameClock* clk, gpointer data) {
+	gint64 start = g_get_monotonic_time();
+	gint64 took;
+	gchar buf[16];
+
+	frame_requested = FALSE;
+	for(guint w=0; w<G_N_ELEMENTS(axis_dirty); w++) {
+		guint32 bits = axis_dirty[w];
+
+		axis_dirty[w] = 0;
+		while(bits) {
+			guint i = w * 32 + g_bit_nth_lsf(bits, -1);
+
+			bits &= bits - 1;
+			if(i < axis_count) {
+				g_snprintf(buf, sizeof buf, "%d", axis_values[i]);
+				gtk_label_set_text(GTK_LABEL(axis_labels[i]), buf);
+			}
+		}
+	}
+	for(guint w=0; w<G_N_ELEMENTS(button_dirty); w++) {
+		guint32 bits = button_dirty[w];
+
+		button_dirty[w] = 0;
+		while(bits) {
+			guint i = w * 32 + g_bit_nth_lsf(bits, -1);
+
+			bits &= bits - 1;
+			if(i < button_count) {
+				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button_checks[i]), button_values[i]);
+			}
+		}
+	}
+	for(guint i=0; i<axis_count; i++) {
+		plot_scroll(histories[i], gdk_frame_clock_get_frame_time(clk));
+	}
+	/* The plots move even when the values do not */
+	if(axis_count > 0) {
+		request_frame();
+	}
+	took = g_get_monotonic_time() - start;
+	stats_frames++;
+	stats_apply += took;
+	if(took > stats_apply_max) {
+		stats_apply_max = took;
+	}
+}
+
+static gboolean update_stats(gpointer data) {
+	gint64 now = g_get_monotonic_time();
+	gdouble secs = (now - stats_start) / (gdouble)G_USEC_PER_SEC;
+	gchar* text;
+
+	text = g_strdup_printf(_("%.0f events/s, %.0f frames/s, apply %.1f us avg, %" G_GINT64_FORMAT " us max"),
+			stats_events / secs, stats_frames / secs,
+			stats_frames ? (gdouble)stats_apply / stats_frames : 0.0,
+			stats_apply_max);
+	gtk_label_set_text(stats_label, text);
+	g_free(text);
+
+	stats_events = stats_frames = 0;
+	stats_apply = stats_apply_max = 0;
+	stats_start = now;
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void window_realized(GtkWidget* window, gpointer data) {
+	clock = gtk_widget_get_frame_clock(window);
+	g_signal_connect(G_OBJECT(clock), "update", G_CALLBACK(frame_update), NULL);
+	joy_model_set_frame_clock(JOY_MODEL(data), clock);
+	request_frame();
 }
 
 static void lost(JoyStick* stick) {
@@ -63,51 +340,80 @@ static void lost(JoyStick* stick) {
 }
 
 static void set_axis_count(JoyStick* stick, guchar count, GtkBuilder* builder) {
-	static guchar curcount = 0;
 	GtkGrid* grid = GTK_GRID(gtk_builder_get_object(builder, "detailsgrid"));
 
-	if(count > curcount) {
-		for(int i=curcount; i<count; i++) {
+	if(count > axis_count) {
+		for(int i=axis_count; i<count; i++) {
 			GtkWidget* widg = gtk_label_new("0");
 			g_object_set(G_OBJECT(widg), "xalign", 0.0, "width_chars", 6, NULL);
 			gtk_grid_attach(grid, widg, i+2, 2, 1, 1);
+			axis_labels[i] = widg;
+			histories[i] = history_new(grid, i);
 		}
 	} else {
-		for(int i=curcount-1; i>=count; i--) {
-			gtk_widget_destroy(gtk_grid_get_child_at(grid, i+2, 2));
+		for(int i=axis_count-1; i>=count; i--) {
+			gtk_widget_destroy(axis_labels[i]);
+			axis_labels[i] = NULL;
+			history_free(histories[i]);
+			histories[i] = NULL;
 		}
 	}
 	for(unsigned char i=0; i<count; i++) {
+		AxisHistory* h = histories[i];
 		gchar* name = g_strdup_printf("Axis %u (%s)", i, joy_stick_describe_axis(stick, i));
-		gtk_widget_set_tooltip_text(gtk_grid_get_child_at(grid, i+2, 2), name);
+		gtk_widget_set_tooltip_text(axis_labels[i], name);
+		gtk_widget_set_tooltip_text(h->area, name);
 		g_free(name);
+		if(!joy_stick_get_axis_range(stick, i, &h->min, &h->max) || h->min >= h->max) {
+			h->min = -32767;
+			h->max = 32767;
+		}
 	}
 	gtk_widget_show_all(GTK_WIDGET(grid));
-	curcount = count;
+	axis_count = count;
 }
 
 static void set_button_count(JoyStick* stick, guchar count, GtkBuilder* builder) {
-	static guchar curcount = 0;
 	GtkGrid* grid = GTK_GRID(gtk_builder_get_object(builder, "detailsgrid"));
 
-	if(count > curcount) {
-		for(int i=curcount; i<count; i++) {
+	if(count > button_count) {
+		for(int i=button_count; i<count; i++) {
 			GtkWidget* but = gtk_check_button_new();
 			gtk_widget_set_sensitive(but, FALSE);
 			gtk_grid_attach(grid, but, i+2, 1, 1, 1);
+			button_checks[i] = but;
 		}
 	} else {
-		for(int i=curcount-1; i>=count; i--) {
-			gtk_widget_destroy(gtk_grid_get_child_at(grid, i+2, 1));
+		for(int i=button_count-1; i>=count; i--) {
+			gtk_widget_destroy(button_checks[i]);
+			button_checks[i] = NULL;
 		}
 	}
 	for(unsigned char i=0; i<count; i++) {
 		gchar* name = g_strdup_printf("Button %u (%s)", i, joy_stick_describe_button(stick, i));
-		gtk_widget_set_tooltip_text(gtk_grid_get_child_at(grid, i+2, 1), name);
+		gtk_widget_set_tooltip_text(button_checks[i], name);
 		g_free(name);
 	}
 	gtk_widget_show_all(GTK_WIDGET(grid));
-	curcount = count;
+	button_count = count;
+}
+
+/* Show the current state of the active joystick, rather than whatever
+ * the widgets showed for the previous one */
+static void load_values(void) {
+	joy_stick_get_values(active, axis_values, axis_count, button_values, button_count);
+	for(guint i=0; i<axis_count; i++) {
+		AxisHistory* h = histories[i];
+
+		h->head = h->drawn = 0;
+		h->last = axis_values[i];
+		/* have plot_draw() start over */
+		h->width = 0;
+		gtk_widget_queue_draw(h->area);
+	}
+	memset(axis_dirty, 0xff, sizeof axis_dirty);
+	memset(button_dirty, 0xff, sizeof button_dirty);
+	request_frame();
 }
 
 void tree_selection_changed(GtkTreeSelection* sel, gpointer data) {
@@ -145,11 +451,15 @@ void tree_selection_changed(GtkTreeSelection* sel, gpointer data) {
 
 		set_axis_count(active, axes, builder);
 		set_button_count(active, buttons, builder);
+		load_values();
 		gtk_container_child_set(GTK_CONTAINER(grid), widget, "width", axes > buttons ? axes : (buttons > 1 ? buttons : 1), NULL);
+		for(guint i=0; i<axes; i++) {
+			gtk_container_child_set(GTK_CONTAINER(grid), histories[i]->area, "width", (axes > buttons ? axes : buttons) + 1, NULL);
+		}
 
-		button_p_handler = g_signal_connect(G_OBJECT(active), "button-pressed", G_CALLBACK(button_pressed), grid);
-		button_r_handler = g_signal_connect(G_OBJECT(active), "button-released", G_CALLBACK(button_released), grid);
-		axis_handler = g_signal_connect(G_OBJECT(active), "axis-moved", G_CALLBACK(axis_moved), grid);
+		button_p_handler = g_signal_connect(G_OBJECT(active), "button-pressed", G_CALLBACK(button_pressed), NULL);
+		button_r_handler = g_signal_connect(G_OBJECT(active), "button-released", G_CALLBACK(button_released), NULL);
+		axis_handler = g_signal_connect(G_OBJECT(active), "axis-moved", G_CALLBACK(axis_moved), NULL);
 		lost_handler = g_signal_connect(G_OBJECT(active), "disconnected", G_CALLBACK(lost), NULL);
 	} else {
 		set_axis_count(NULL, 0, builder);
@@ -200,6 +510,11 @@ int main(int argc, char** argv) {
 	select = gtk_tree_view_get_selection(GTK_TREE_VIEW(treeview));
 	g_signal_connect(G_OBJECT(select), "changed", G_CALLBACK(tree_selection_changed), builder);
 
+	stats_label = GTK_LABEL(gtk_builder_get_object(builder, "statslabel"));
+	stats_start = g_get_monotonic_time();
+	g_timeout_add_seconds(1, update_stats, NULL);
+
+	g_signal_connect(G_OBJECT(window), "realize", G_CALLBACK(window_realized), model);
 	g_signal_connect(G_OBJECT(window), "delete-event", gtk_main_quit, NULL);
 
 	gtk_widget_show_all(window);
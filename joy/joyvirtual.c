@@ -0,0 +1,552 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#define _GNU_SOURCE
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+
+#include <linux/input.h>
+
+#include <joy/joyvirtual.h>
+#include "joy-private.h"
+
+/**
+  * SECTION:joyvirtual
+  * @short_description: a joystick that exists only in memory
+  * @see_also: #JoyStick
+  * @stability: Unstable
+  * @include: joy/joyvirtual.h
+  *
+  * A #JoyVirtual is a joystick without hardware: the program that
+  * creates it decides what axes and buttons it has, and what it reports.
+  * It is opened like any other joystick, by passing the device node
+  * returned by joy_virtual_get_devnode() to joy_stick_open(); the
+  * resulting #JoyStick issues its events through exactly the same code
+  * as it would for a real device, in every #JoyMode, and can be added to
+  * a #JoyHub. This makes it possible to test an application, or libjoy
+  * itself, without any hardware attached.
+  *
+  * Changes are reported with joy_virtual_set_axis() and
+  * joy_virtual_set_button(), and handed to the #JoyStick as one report
+  * of the hardware by joy_virtual_sync().
+  *
+  * A #JoyVirtual is not thread-safe: it must only be used from one
+  * thread at a time, and that includes opening it with joy_stick_open().
+  * The #JoyStick may issue its events on any thread.
+  */
+
+#define VIRTUAL_PREFIX "virtual:"
+
+/* The number of records that can be written to a pipe atomically */
+#define CHUNK (PIPE_BUF / sizeof(JoyRecord))
+
+struct _JoyVirtualPrivate {
+	int rfd;
+	int wfd;
+	gchar* name;
+	gchar* devnode;
+	guint8 naxes;
+	guint8 nbuts;
+	guint8 axmap[JOY_STICK_MAX_AXES];
+	guint16 butmap[JOY_STICK_MAX_BUTTONS];
+	gint32 axmin[JOY_STICK_MAX_AXES];
+	gint32 axmax[JOY_STICK_MAX_AXES];
+	gint32 axes[JOY_STICK_MAX_AXES];
+	guint64 buttons[JOY_STICK_MAX_BUTTONS / 64];
+	GArray* pending;
+};
+
+enum {
+	JOY_VIRTUAL_NAME = 1,
+	JOY_VIRTUAL_DEVNODE,
+	JOY_VIRTUAL_PROP_COUNT,
+};
+
+static GParamSpec *props[JOY_VIRTUAL_PROP_COUNT] = { NULL, };
+
+static GObjectClass* parent_class = NULL;
+
+/* All JoyVirtual objects by device node, so that the backend can find
+ * them; the table does not hold a reference */
+static GHashTable* devices = NULL;
+G_LOCK_DEFINE_STATIC(devices);
+static gint serial = 0;
+
+/**
+  * joy_virtual_new: (constructor)
+  * @name: the name of the joystick, as returned by joy_stick_describe()
+  *
+  * Create a new virtual joystick without any axes or buttons.
+  *
+  * Returns: a newly-allocated #JoyVirtual.
+  */
+JoyVirtual* joy_virtual_new(const gchar* name) {
+	return JOY_VIRTUAL(g_object_new(JOY_TYPE_VIRTUAL, "name", name, NULL));
+}
+
+/**
+  * joy_virtual_add_axis:
+  * @self: a #JoyVirtual
+  * @type: the type of the axis, as returned by joy_stick_get_axis_type()
+  * @min: the minimum value of the axis
+  * @max: the maximum value of the axis
+  *
+  * Add an axis to the virtual joystick. Its initial value is 0. Axes and
+  * buttons that are added while a #JoyStick has the virtual joystick open
+  * only become visible when it is opened again.
+  *
+  * Returns: the number of the new axis, or -1 if the joystick already
+  * has the maximum number of axes.
+  */
+gint joy_virtual_add_axis(JoyVirtual* self, JoyAxisType type, gint32 min, gint32 max) {
+	g_return_val_if_fail(JOY_IS_VIRTUAL(self), -1);
+	if(self->priv->naxes == JOY_STICK_MAX_AXES) {
+		return -1;
+	}
+	self->priv->axmap[self->priv->naxes] = type;
+	self->priv->axmin[self->priv->naxes] = min;
+	self->priv->axmax[self->priv->naxes] = max;
+	return self->priv->naxes++;
+}
+
+/**
+  * joy_virtual_add_button:
+  * @self: a #JoyVirtual
+  * @type: the type of the button, as returned by
+  * joy_stick_get_button_type()
+  *
+  * Add a button to the virtual joystick. It is initially released.
+  *
+  * Returns: the number of the new button, or -1 if the joystick already
+  * has the maximum number of buttons.
+  */
+gint joy_virtual_add_button(JoyVirtual* self, JoyBtnType type) {
+	g_return_val_if_fail(JOY_IS_VIRTUAL(self), -1);
+	/* n_buttons is a guint8 */
+	if(self->priv->nbuts == G_MAXUINT8) {
+		return -1;
+	}
+	self->priv->butmap[self->priv->nbuts] = BTN_MISC + type;
+	return self->priv->nbuts++;
+}
+
+/**
+  * joy_virtual_get_devnode:
+  * @self: a #JoyVirtual
+  *
+  * Get the name under which joy_stick_open() finds this virtual
+  * joystick. It does not exist in the file system.
+  *
+  * Returns: (transfer none): the device node of the virtual joystick.
+  */
+const gchar* joy_virtual_get_devnode(JoyVirtual* self) {
+	g_return_val_if_fail(JOY_IS_VIRTUAL(self), NULL);
+	return self->priv->devnode;
+}
+
+static void joy_virtual_queue(JoyVirtual* self, guint8 type, guint8 number, gint32 value) {
+	JoyRecord rec = { 0, };
+
+	if(self->priv->wfd < 0) {
+		return;
+	}
+	rec.time = g_get_monotonic_time();
+	rec.value = value;
+	rec.type = type;
+	rec.number = number;
+	g_array_append_val(self->priv->pending, rec);
+}
+
+/* Write as many records as the pipe will take, in chunks that are
+ * written atomically, so that a record is never cut in half. Returns the
+ * number of records written. */
+gsize _joy_record_write(int fd, const JoyRecord* recs, gsize count) {
+	gsize done = 0;
+
+	while(done < count) {
+		gsize n = MIN(count - done, CHUNK);
+		gssize rv = write(fd, recs + done, n * sizeof(JoyRecord));
+
+		if(rv < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		done += n;
+	}
+	return done;
+}
+
+/**
+  * joy_virtual_set_axis:
+  * @self: a #JoyVirtual
+  * @axis: the number of the axis
+  * @value: the new value of the axis
+  *
+  * Move an axis. The change is only seen by the #JoyStick after the next
+  * call to joy_virtual_sync().
+  */
+void joy_virtual_set_axis(JoyVirtual* self, guint8 axis, gint32 value) {
+	g_return_if_fail(JOY_IS_VIRTUAL(self));
+	g_return_if_fail(axis < self->priv->naxes);
+	self->priv->axes[axis] = value;
+	joy_virtual_queue(self, JOY_EVENT_AXIS, axis, value);
+}
+
+/**
+  * joy_virtual_set_button:
+  * @self: a #JoyVirtual
+  * @button: the number of the button
+  * @pressed: whether the button is now pressed
+  *
+  * Press or release a button. The change is only seen by the #JoyStick
+  * after the next call to joy_virtual_sync().
+  */
+void joy_virtual_set_button(JoyVirtual* self, guint8 button, gboolean pressed) {
+	g_return_if_fail(JOY_IS_VIRTUAL(self));
+	g_return_if_fail(button < self->priv->nbuts);
+	if(pressed) {
+		self->priv->buttons[button / 64] |= G_GUINT64_CONSTANT(1) << (button % 64);
+	} else {
+		self->priv->buttons[button / 64] &= ~(G_GUINT64_CONSTANT(1) << (button % 64));
+	}
+	joy_virtual_queue(self, JOY_EVENT_BUTTON, button, pressed ? 1 : 0);
+}
+
+/**
+  * joy_virtual_sync:
+  * @self: a #JoyVirtual
+  *
+  * End a report of the virtual hardware: hand all changes since the last
+  * call to the #JoyStick, which will issue them along with a
+  * #JoyStick::report signal.
+  *
+  * If the #JoyStick does not keep up, the changes that do not fit in its
+  * queue stay pending, and are handed over by the next call to this
+  * function.
+  *
+  * Returns: %TRUE if all changes were handed over, %FALSE if some are
+  * still pending, or the joystick was unplugged.
+  */
+gboolean joy_virtual_sync(JoyVirtual* self) {
+	GArray* pending;
+	gsize done;
+
+	g_return_val_if_fail(JOY_IS_VIRTUAL(self), FALSE);
+	if(self->priv->wfd < 0) {
+		return FALSE;
+	}
+	joy_virtual_queue(self, JOY_EVENT_SYNC, 0, 0);
+	pending = self->priv->pending;
+	done = _joy_record_write(self->priv->wfd, (JoyRecord*)pending->data, pending->len);
+	g_array_remove_range(pending, 0, done);
+	return pending->len == 0;
+}
+
+/**
+  * joy_virtual_unplug:
+  * @self: a #JoyVirtual
+  *
+  * Disconnect the virtual joystick: once the #JoyStick has read all
+  * changes that were handed over before, it issues the
+  * #JoyStick::disconnected signal. The virtual joystick cannot be opened
+  * again.
+  */
+void joy_virtual_unplug(JoyVirtual* self) {
+	g_return_if_fail(JOY_IS_VIRTUAL(self));
+	if(self->priv->wfd < 0) {
+		return;
+	}
+	close(self->priv->wfd);
+	self->priv->wfd = -1;
+	g_array_set_size(self->priv->pending, 0);
+}
+
+/* Helpers for the backends that read records from a pipe */
+
+int _joy_record_pipe(int fds[2]) {
+	if(pipe2(fds, O_CLOEXEC) < 0) {
+		return -1;
+	}
+	/* The JoyStick decides whether its end blocks; ours must not, or a
+	 * JoyStick on the same thread could never catch up */
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	/* Queue as much as the system allows */
+	fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+	return 0;
+}
+
+void _joy_record_reset(int rfd, int wfd, guint8 naxes, const gint32* axes, guint8 nbuts, const guint64* buttons) {
+	JoyRecord dump[JOY_STICK_MAX_AXES + JOY_STICK_MAX_BUTTONS + 1];
+	guchar stale[PIPE_BUF];
+	gint64 now = g_get_monotonic_time();
+	gsize n = 0;
+	int avail;
+
+	/* Whatever the JoyStick has not read yet is of no interest anymore.
+	 * The pipe may be in blocking mode, so read only what is there;
+	 * since the pipe only ever holds whole records, and stale is a
+	 * multiple of the record size, this never splits a record, even if
+	 * the JoyStick reads at the same time. */
+	if(ioctl(rfd, FIONREAD, &avail) == 0) {
+		while(avail > 0) {
+			gssize rv = read(rfd, stale, MIN((gsize)avail, sizeof(stale)));
+			if(rv <= 0) {
+				break;
+			}
+			avail -= rv;
+		}
+	}
+	/* Like a kernel interface, start with the complete state */
+	memset(dump, 0, sizeof(dump));
+	for(guint i=0; i<naxes; i++, n++) {
+		dump[n].time = now;
+		dump[n].value = axes[i];
+		dump[n].type = JOY_EVENT_AXIS;
+		dump[n].number = i;
+		dump[n].flags = JOY_EVENT_INIT;
+	}
+	for(guint i=0; i<nbuts; i++, n++) {
+		dump[n].time = now;
+		dump[n].value = (buttons[i / 64] >> (i % 64)) & 1;
+		dump[n].type = JOY_EVENT_BUTTON;
+		dump[n].number = i;
+		dump[n].flags = JOY_EVENT_INIT;
+	}
+	dump[n].time = now;
+	dump[n].type = JOY_EVENT_SYNC;
+	dump[n].flags = JOY_EVENT_INIT;
+	_joy_record_write(wfd, dump, n + 1);
+}
+
+int _joy_record_open(int rfd, int wfd, guint8 naxes, const gint32* axes, guint8 nbuts, const guint64* buttons) {
+	int fd = fcntl(rfd, F_DUPFD_CLOEXEC, 0);
+
+	if(fd >= 0) {
+		_joy_record_reset(rfd, wfd, naxes, axes, nbuts, buttons);
+	}
+	return fd;
+}
+
+/* The records are events already */
+gsize _joy_record_convert(gpointer data G_GNUC_UNUSED, int fd G_GNUC_UNUSED, const void* records, gsize count, JoyEvent* events) {
+	const JoyRecord* recs = records;
+
+	for(gsize i=0; i<count; i++) {
+		events[i].time = recs[i].time;
+		events[i].rtime = 0;
+		events[i].value = recs[i].value;
+		events[i].type = recs[i].type;
+		events[i].number = recs[i].number;
+		events[i].flags = recs[i].flags;
+	}
+	return count;
+}
+
+/* The backend */
+
+static int virtual_open(const gchar* devnode, gpointer* data) {
+	JoyVirtual* self;
+	int fd;
+
+	G_LOCK(devices);
+	self = devices ? g_hash_table_lookup(devices, devnode) : NULL;
+	if(self) {
+		g_object_ref(self);
+	}
+	G_UNLOCK(devices);
+	if(!self) {
+		errno = ENOENT;
+		return -1;
+	}
+	if(self->priv->wfd < 0) {
+		g_object_unref(self);
+		errno = ENODEV;
+		return -1;
+	}
+	fd = _joy_record_open(self->priv->rfd, self->priv->wfd, self->priv->naxes, self->priv->axes, self->priv->nbuts, self->priv->buttons);
+	if(fd < 0) {
+		g_object_unref(self);
+		return -1;
+	}
+	*data = self;
+	return fd;
+}
+
+static gboolean virtual_probe(int fd G_GNUC_UNUSED, JoyDeviceInfo* info, gpointer* data) {
+	JoyVirtual* self = *data;
+
+	if(!self) {
+		return FALSE;
+	}
+	info->naxes = self->priv->naxes;
+	info->nbuts = self->priv->nbuts;
+	memcpy(info->axmap, self->priv->axmap, sizeof(info->axmap));
+	memcpy(info->butmap, self->priv->butmap, sizeof(info->butmap));
+	memcpy(info->axmin, self->priv->axmin, sizeof(info->axmin));
+	memcpy(info->axmax, self->priv->axmax, sizeof(info->axmax));
+	g_strlcpy(info->name, self->priv->name ? self->priv->name : "", sizeof(info->name));
+	return TRUE;
+}
+
+const JoyBackend _joy_backend_virtual = {
+	"virtual",
+	sizeof(JoyRecord),
+	VIRTUAL_PREFIX,
+	virtual_open,
+	virtual_probe,
+	_joy_record_convert,
+	NULL,	/* grab */
+	g_object_unref,
+};
+
+/* The object */
+
+static void instance_init(GTypeInstance* instance, gpointer g_class G_GNUC_UNUSED) {
+	JoyVirtual *self = JOY_VIRTUAL(instance);
+	int fds[2];
+
+	self->priv = g_new0(JoyVirtualPrivate, 1);
+	self->priv->rfd = self->priv->wfd = -1;
+	if(_joy_record_pipe(fds) < 0) {
+		g_warning("Could not create virtual joystick: %s", g_strerror(errno));
+	} else {
+		self->priv->rfd = fds[0];
+		self->priv->wfd = fds[1];
+	}
+	self->priv->pending = g_array_new(FALSE, FALSE, sizeof(JoyRecord));
+	self->priv->devnode = g_strdup_printf(VIRTUAL_PREFIX "%d", g_atomic_int_add(&serial, 1));
+	G_LOCK(devices);
+	if(!devices) {
+		devices = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+	g_hash_table_insert(devices, self->priv->devnode, self);
+	G_UNLOCK(devices);
+}
+
+static void get_property(GObject* object, guint property_id, GValue *value, GParamSpec *pspec) {
+	JoyVirtual *self = JOY_VIRTUAL(object);
+
+	switch(property_id) {
+	case JOY_VIRTUAL_NAME:
+		g_value_set_string(value, self->priv->name);
+		break;
+	case JOY_VIRTUAL_DEVNODE:
+		g_value_set_string(value, self->priv->devnode);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+static void set_property(GObject* object, guint property_id, const GValue *value, GParamSpec *pspec) {
+	JoyVirtual *self = JOY_VIRTUAL(object);
+
+	switch(property_id) {
+	case JOY_VIRTUAL_NAME:
+		g_free(self->priv->name);
+		self->priv->name = g_value_dup_string(value);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+static void finalize(GObject* object) {
+	JoyVirtual* self = JOY_VIRTUAL(object);
+
+	G_LOCK(devices);
+	g_hash_table_remove(devices, self->priv->devnode);
+	G_UNLOCK(devices);
+	if(self->priv->wfd >= 0) {
+		close(self->priv->wfd);
+	}
+	if(self->priv->rfd >= 0) {
+		close(self->priv->rfd);
+	}
+	g_array_free(self->priv->pending, TRUE);
+	g_free(self->priv->name);
+	g_free(self->priv->devnode);
+	g_free(self->priv);
+	parent_class->finalize(object);
+}
+
+static void class_init(gpointer g_class, gpointer g_class_data G_GNUC_UNUSED) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(g_class);
+
+	parent_class = g_type_class_peek_parent(g_class);
+	gobject_class->get_property = get_property;
+	gobject_class->set_property = set_property;
+	gobject_class->finalize = finalize;
+/**
+ * JoyVirtual:name:
+ *
+ * The name of the virtual joystick, as returned by joy_stick_describe().
+ */
+	props[JOY_VIRTUAL_NAME] =
+	  g_param_spec_string("name",
+				    "Name",
+				    "The name of the virtual joystick",
+				    "Virtual joystick",
+				    G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+/**
+ * JoyVirtual:devnode:
+ *
+ * The name under which joy_stick_open() finds the virtual joystick.
+ */
+	props[JOY_VIRTUAL_DEVNODE] =
+	  g_param_spec_string("devnode",
+				    "Device node",
+				    "The name under which joy_stick_open() finds the virtual joystick",
+				    NULL,
+				    G_PARAM_READABLE);
+	g_object_class_install_properties(gobject_class, JOY_VIRTUAL_PROP_COUNT, props);
+}
+
+GType joy_virtual_get_type(void) {
+	static GType type = 0;
+	if(!type) {
+		static const GTypeInfo info = {
+			sizeof(JoyVirtualClass),
+			NULL,	/* base_init */
+			NULL,	/* base_finalize */
+			class_init,	/* class_init */
+			NULL,	/* class_finalize */
+			NULL,	/* class_data */
+			sizeof(JoyVirtual),
+			0,	/* n_preallocs */
+			instance_init,
+		};
+		type = g_type_register_static(G_TYPE_OBJECT,
+					      "JoyVirtual",
+					      &info, 0);
+	}
+
+	return type;
+}
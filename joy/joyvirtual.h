@@ -0,0 +1,73 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This library is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef LIBJOY_VIRTUAL_H
+#define LIBJOY_VIRTUAL_H
+
+#include <joy/joystick.h>
+
+G_BEGIN_DECLS
+
+#define JOY_TYPE_VIRTUAL		(joy_virtual_get_type())
+#define JOY_VIRTUAL(obj)		(G_TYPE_CHECK_INSTANCE_CAST((obj), JOY_TYPE_VIRTUAL, JoyVirtual))
+#define JOY_VIRTUAL_CLASS(vtable)	(G_TYPE_CHECK_CLASS_CAST((vtable), JOY_TYPE_VIRTUAL, JoyVirtualClass))
+#define JOY_IS_VIRTUAL(obj)		(G_TYPE_CHECK_INSTANCE_TYPE((obj), JOY_TYPE_VIRTUAL))
+#define JOY_IS_VIRTUAL_CLASS(vtable)	(G_TYPE_CHECK_CLASS_TYPE((vtable), JOY_TYPE_VIRTUAL))
+#define JOY_VIRTUAL_GET_CLASS(inst)	(G_TYPE_INSTANCE_GET_CLASS((inst), JOY_TYPE_VIRTUAL, JoyVirtualClass))
+
+typedef struct _JoyVirtual JoyVirtual;
+typedef struct _JoyVirtualClass JoyVirtualClass;
+typedef struct _JoyVirtualPrivate JoyVirtualPrivate;
+
+/**
+  * JoyVirtual:
+  *
+  * Opaque object representing a joystick that exists only in memory
+  */
+struct _JoyVirtual {
+	/*< private >*/
+	GObject parent;
+	JoyVirtualPrivate *priv;
+};
+
+/**
+  * JoyVirtualClass:
+  */
+struct _JoyVirtualClass {
+	/*< private >*/
+	GObjectClass parent;
+};
+
+/* constructors */
+JoyVirtual* joy_virtual_new(const gchar* name);
+/* instance functions */
+gint joy_virtual_add_axis(JoyVirtual* self, JoyAxisType type, gint32 min, gint32 max);
+gint joy_virtual_add_button(JoyVirtual* self, JoyBtnType type);
+const gchar* joy_virtual_get_devnode(JoyVirtual* self);
+void joy_virtual_set_axis(JoyVirtual* self, guint8 axis, gint32 value);
+void joy_virtual_set_button(JoyVirtual* self, guint8 button, gboolean pressed);
+gboolean joy_virtual_sync(JoyVirtual* self);
+void joy_virtual_unplug(JoyVirtual* self);
+
+/* type handling functions */
+GType joy_virtual_get_type(void) G_GNUC_PURE;
+
+G_END_DECLS
+
+#endif // LIBJOY_VIRTUAL_H
@@ -0,0 +1,154 @@
+/*
+ * libjoy - GObject-based joystick API
+ *
+ * Copyright(c) Wouter Verhelst, 2014
+ *
+ * This program is free software; you can copy it under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+/* Check that issuing events does not allocate memory.
+ *
+ * Like bench-dispatch, this feeds js_event records through a FIFO that is
+ * opened as a joystick, with handlers connected to every signal; once a
+ * first batch of events has been issued (GObject sets up some caches the
+ * first time a signal is emitted), handling further events must not make
+ * a single allocation. Both joy_stick_iteration() and the main loop
+ * source are checked. */
+#include <errno.h>
+#include <unistd.h>
+
+#include <linux/joystick.h>
+
+#include <joy/joystick.h>
+#include "bench-util.h"
+
+#define NAXES 8
+#define NBUTTONS 16
+#define WARMUP 256
+#define NEVENTS 16384
+/* Fits in the buffer of a FIFO */
+#define CHUNK 512
+
+static gchar* dir;
+static guint64 nsignals;
+
+static void on_button(JoyStick* stick G_GNUC_UNUSED, guchar button G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED) {
+	nsignals++;
+}
+
+static void on_axis(JoyStick* stick G_GNUC_UNUSED, guchar axis G_GNUC_UNUSED, gint value G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED) {
+	nsignals++;
+}
+
+static void on_report(JoyStick* stick G_GNUC_UNUSED, gpointer report G_GNUC_UNUSED, gpointer data G_GNUC_UNUSED) {
+	nsignals++;
+}
+
+static void feed(int wfd, guint64 seq, gint count) {
+	struct js_event evs[CHUNK];
+
+	g_assert_cmpint(count, <=, CHUNK);
+	js_event_fill(evs, count, seq, NAXES, NBUTTONS);
+	g_assert_cmpint(write(wfd, evs, count * sizeof(struct js_event)), ==, count * sizeof(struct js_event));
+}
+
+static JoyStick* setup(JoyMode mode, int* wfd) {
+	gchar* path = g_build_filename(dir, "js0", NULL);
+	JoyStick* stick = fifo_stick_open(path, NAXES, NBUTTONS, wfd);
+
+	g_free(path);
+	if(!stick) {
+		g_error("Could not open a FIFO as a joystick: %s", g_strerror(errno));
+	}
+	joy_stick_set_mode(stick, mode);
+	g_signal_connect(stick, "button-pressed", G_CALLBACK(on_button), NULL);
+	g_signal_connect(stick, "button-released", G_CALLBACK(on_button), NULL);
+	g_signal_connect(stick, "axis-moved", G_CALLBACK(on_axis), NULL);
+	g_signal_connect(stick, "report", G_CALLBACK(on_report), NULL);
+	nsignals = 0;
+	return stick;
+}
+
+static void teardown(JoyStick* stick, int wfd) {
+	gchar* path = g_build_filename(dir, "js0", NULL);
+
+	g_object_unref(stick);
+	close(wfd);
+	unlink(path);
+	g_free(path);
+}
+
+static void test_iteration(void) {
+	guint64 allocs = 0;
+	guint64 warm;
+	int wfd;
+	JoyStick* stick = setup(JOY_MODE_MANUAL, &wfd);
+
+	feed(wfd, 0, WARMUP);
+	for(gint i=0; i<WARMUP; i++) {
+		joy_stick_iteration(stick);
+	}
+	warm = nsignals;
+	g_assert_cmpuint(warm, >, 0);
+	for(guint64 seq=WARMUP; seq<WARMUP + NEVENTS; seq+=CHUNK) {
+		feed(wfd, seq, CHUNK);
+		alloc_count_start();
+		for(gint i=0; i<CHUNK; i++) {
+			joy_stick_iteration(stick);
+		}
+		allocs += alloc_count_stop();
+	}
+	g_assert_cmpuint(nsignals, >, warm);
+	g_assert_cmpuint(allocs, ==, 0);
+	teardown(stick, wfd);
+}
+
+static void test_mainloop(void) {
+	guint64 allocs = 0;
+	guint64 warm;
+	int wfd;
+	JoyStick* stick = setup(JOY_MODE_MAINLOOP, &wfd);
+
+	feed(wfd, 0, WARMUP);
+	while(g_main_context_iteration(NULL, FALSE));
+	warm = nsignals;
+	g_assert_cmpuint(warm, >, 0);
+	for(guint64 seq=WARMUP; seq<WARMUP + NEVENTS; seq+=CHUNK) {
+		feed(wfd, seq, CHUNK);
+		alloc_count_start();
+		while(g_main_context_iteration(NULL, FALSE));
+		allocs += alloc_count_stop();
+	}
+	g_assert_cmpuint(nsignals, >, warm);
+	g_assert_cmpuint(allocs, ==, 0);
+	teardown(stick, wfd);
+}
+
+int main(int argc, char** argv) {
+	GError* err = NULL;
+	int rv;
+
+	g_test_init(&argc, &argv, NULL);
+	dir = g_dir_make_tmp("joytest-XXXXXX", &err);
+	g_assert_no_error(err);
+	g_test_add_func("/dispatch/allocations/iteration", test_iteration);
+	g_test_add_func("/dispatch/allocations/mainloop", test_mainloop);
+	rv = g_test_run();
+	rmdir(dir);
+	g_free(dir);
+
+	return rv;
+}